@@ -9,6 +9,7 @@
 typedef struct {
     bool optimize;
     bool debug;
+    const char *define; // extra -D flag, NULL for none
 } Options;
 
 void usage(FILE *stream)
@@ -25,7 +26,11 @@ bool build_target_sync_and_reset(Nob_Cmd *cmd, const char *target, const char *o
     nob_cmd_append(cmd, "-Wall", "-Wextra");
     if (options.optimize) nob_cmd_append(cmd, "-O3");
     if (options.debug) nob_cmd_append(cmd, "-ggdb");
+    if (options.define != NULL) nob_cmd_append(cmd, options.define);
     nob_cmd_append(cmd, "-lm");
+#ifndef _WIN32
+    nob_cmd_append(cmd, "-pthread");
+#endif
     
     if (!nob_cmd_run_sync_and_reset(cmd)) return false;
     
@@ -60,6 +65,9 @@ bool build_python_library_sync_and_reset(Nob_Cmd *cmd, char *version, const char
     if (options.optimize) nob_cmd_append(cmd, "-O3");
     if (options.debug) nob_cmd_append(cmd, "-ggdb");
     nob_cmd_append(cmd, nob_temp_sprintf("-I%s", python_include_path));
+#ifndef _WIN32
+    nob_cmd_append(cmd, "-pthread");
+#endif
 #ifdef _WIN32
     nob_cmd_append(cmd, nob_temp_sprintf("-L%s", python_library_path));
 #endif
@@ -108,6 +116,15 @@ int main(int argc, char **argv) {
 
     if (!build_target_sync_and_reset(&cmd, SOURCE_FOLDER"qoi_to_png.c", BUILD_FOLDER"qoi_to_png", options)) return 1;
     if (!build_target_sync_and_reset(&cmd, SOURCE_FOLDER"png_to_qoi.c", BUILD_FOLDER"png_to_qoi", options)) return 1;
+    if (!build_target_sync_and_reset(&cmd, SOURCE_FOLDER"qoi_bench.c", BUILD_FOLDER"qoi_bench", options)) return 1;
+    Options generic = options;
+    generic.define = "-DQOI_GENERIC_ONLY";
+    if (!build_target_sync_and_reset(&cmd, SOURCE_FOLDER"qoi_bench.c", BUILD_FOLDER"qoi_bench_generic", generic)) return 1;
+    Options switch_dispatch = options;
+    switch_dispatch.define = "-DQOI_NO_COMPUTED_GOTO";
+    if (!build_target_sync_and_reset(&cmd, SOURCE_FOLDER"qoi_bench.c", BUILD_FOLDER"qoi_bench_switch", switch_dispatch)) return 1;
+    if (!build_target_sync_and_reset(&cmd, SOURCE_FOLDER"qoi_scan.c", BUILD_FOLDER"qoi_scan", options)) return 1;
+    if (!build_target_sync_and_reset(&cmd, SOURCE_FOLDER"qoi_check.c", BUILD_FOLDER"qoi_check", options)) return 1;
 #ifndef _WIN32
     if (!build_python_library_sync_and_reset(&cmd, *python_version, nob_temp_sprintf("/usr/include/python%s", *python_version), NULL, options)) return 1;
 #else
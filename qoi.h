@@ -5,6 +5,14 @@
 #include <stdbool.h>
 #include <string.h>
 
+#ifndef QOI_NO_THREADS
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+#endif
+
 #ifndef QOI_H_
 #define QOI_H_
 
@@ -12,6 +20,33 @@
 #define QOI_HEADER_SIZE 14
 #define QOI_END_SIZE 8
 #define QOI_END (uint8_t[]) { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01 }
+#define QOI_PIXELS_MAX 400000000U
+
+// optional seek index appended after the end marker:
+// checkpoints, u32be checkpoint count, u32be rows per checkpoint, QOI_INDEX_MAGIC
+#define QOI_INDEX_MAGIC "qoix"
+#define QOI_INDEX_FOOTER_SIZE 12
+#define QOI_CHECKPOINT_SIZE (4 + 1 + 4 + 64 * 4) // op offset, RUN pixels before the row, prev_px, lookup_array
+
+#ifndef QOI_ENCODE_CHUNK
+#define QOI_ENCODE_CHUNK 65536U
+#endif
+
+#ifndef QOI_PARALLEL_MIN_PIXELS
+#define QOI_PARALLEL_MIN_PIXELS 65536U
+#endif
+
+#ifndef QOI_MAX_THREADS
+#define QOI_MAX_THREADS 256U
+#endif
+
+#ifndef QOI_STREAM_BUFFER_SIZE
+#define QOI_STREAM_BUFFER_SIZE 65536U
+#endif
+
+#ifndef QOI_INDEX_BAND_PIXELS
+#define QOI_INDEX_BAND_PIXELS 1048576U
+#endif
 
 #ifndef QOI_DA_INIT_CAP
 #define QOI_DA_INIT_CAP 65536U
@@ -89,263 +124,2963 @@ typedef struct {
     qoi_rgbas  image_data;
 } qoi_image;
 
-uint8_t qoi_hash(qoi_rgba *color);
+typedef struct {
+    size_t   count;
+    size_t   capacity;
+    uint8_t *items;
+} qoi_bytes;
+
+// Buffers reused across calls: once they're big enough for the largest image, decoding and
+// encoding no longer touch the heap. `image` and `encoded` hold the last results.
+typedef struct {
+    qoi_image image;   // last decoded image
+    qoi_bytes input;   // contents of the last loaded file
+    qoi_bytes encoded; // last encoded image
+} qoi_ctx;
+
+typedef struct {
+    qoi_rgba lookup_array[64];
+    qoi_rgba prev_px;
+    uint32_t run; // pixels of the pending RUN op
+} qoi_state;
+
+typedef enum {
+    QOI_LAYOUT_RGBA,
+    QOI_LAYOUT_RGB,
+    QOI_LAYOUT_BGRA,
+    QOI_LAYOUT_ARGB,
+} qoi_layout;
+
+// Conversions applied while decoding, can be combined
+typedef enum {
+    QOI_CONVERT_NONE        = 0,
+    QOI_CONVERT_LINEAR      = 1 << 0, // sRGB color channels to linear, unless the header says they already are
+    QOI_CONVERT_PREMULTIPLY = 1 << 1, // color channels multiplied by alpha (after linearizing)
+} qoi_convert;
+
+// Instruction set used by the decode and encode hot loops
+typedef enum {
+    QOI_SIMD_SCALAR,
+    QOI_SIMD_SSE2,
+    QOI_SIMD_SSE41,
+    QOI_SIMD_AVX2,
+    QOI_SIMD_AVX512,
+    QOI_SIMD_NEON,
+} qoi_simd_level;
+
+typedef bool (*qoi_write_func)(void *user, const void *data, size_t size);
+
+// Incremental encoder: rows are pushed as they are produced and the encoded bytes are handed to
+// `write` whenever the internal buffer fills up, so memory use doesn't depend on the image height.
+typedef struct {
+    qoi_state      state;
+    uint32_t       width;
+    uint32_t       height;
+    uint32_t       row;
+    qoi_write_func write;
+    void          *user;
+    size_t         count;
+    uint8_t        buffer[QOI_STREAM_BUFFER_SIZE];
+} qoi_encoder;
+
+typedef bool (*qoi_row_func)(void *user, uint32_t y, const qoi_rgba *row, uint32_t width);
+
+typedef enum {
+    QOI_DECODER_HEADER,
+    QOI_DECODER_DATA,
+    QOI_DECODER_END,
+    QOI_DECODER_DONE,
+} qoi_decoder_phase;
+
+// Push decoder: bytes are fed in chunks of any size (ops may be split between chunks)
+// and every completed row is handed to `on_row`; images without pixels have no rows.
+typedef struct {
+    qoi_header        header;
+    qoi_state         state;
+    qoi_decoder_phase phase;
+    uint32_t          row;
+    uint32_t          x;
+    qoi_rgba         *pixels; // current row
+    qoi_row_func      on_row;
+    void             *user;
+    uint32_t          max_pixels; // larger images are rejected, QOI_PIXELS_MAX by default
+    uint8_t           pending[QOI_HEADER_SIZE]; // partial header, op or end marker
+    uint8_t           pending_count;
+} qoi_decoder;
+
+#ifndef QOI_NO_THREADS
+#ifdef _WIN32
+typedef HANDLE qoi_thread;
+typedef CRITICAL_SECTION qoi_mutex;
+typedef CONDITION_VARIABLE qoi_cond;
+#else
+typedef pthread_t qoi_thread;
+typedef pthread_mutex_t qoi_mutex;
+typedef pthread_cond_t qoi_cond;
+#endif
+#endif
+
+uint8_t qoi_hash(const qoi_rgba *color);
+qoi_simd_level qoi_simd(void);
+const char *qoi_simd_name(qoi_simd_level level);
+bool qoi_decode_header(const void *data, size_t data_size, qoi_header *header);
+bool qoi_decode(const void *data, size_t data_size, qoi_image *image);
+bool qoi_decode_parallel(const void *data, size_t data_size, qoi_image *image, uint32_t thread_count);
+bool qoi_decode_limited(const void *data, size_t data_size, qoi_image *image, uint32_t max_pixels, uint32_t thread_count);
+bool qoi_decode_into(const void *data, size_t data_size, qoi_header *header, void *pixels, size_t pixels_size, size_t stride, qoi_layout layout);
+bool qoi_decode_into_converted(const void *data, size_t data_size, qoi_header *header, void *pixels, size_t pixels_size, size_t stride, qoi_layout layout, int convert);
+bool qoi_decode_region(const void *data, size_t data_size, uint32_t x, uint32_t y, uint32_t width, uint32_t height, qoi_image *region);
+bool qoi_decode_region_into(const void *data, size_t data_size, qoi_header *header, uint32_t x, uint32_t y, uint32_t width, uint32_t height, void *pixels, size_t pixels_size, size_t stride, qoi_layout layout);
+bool qoi_decode_downscaled(const void *data, size_t data_size, uint32_t factor, qoi_image *thumb);
+bool qoi_decode_planar(const void *data, size_t data_size, qoi_header *header, uint8_t *const planes[4], size_t plane_size);
+bool qoi_decode_planar_f32(const void *data, size_t data_size, qoi_header *header, float *const planes[4], size_t plane_size, const float scale[4], const float bias[4]);
+bool qoi_decode_planar_f32_converted(const void *data, size_t data_size, qoi_header *header, float *const planes[4], size_t plane_size, const float scale[4], const float bias[4], int convert);
+void qoi_decoder_init(qoi_decoder *decoder, qoi_row_func on_row, void *user);
+bool qoi_decoder_push(qoi_decoder *decoder, const void *data, size_t data_size);
+bool qoi_decoder_finish(qoi_decoder *decoder);
+void qoi_decoder_free(qoi_decoder *decoder);
+bool qoi_validate(const void *data, size_t data_size, qoi_header *header);
+bool qoi_validate_hash(const void *data, size_t data_size, qoi_header *header, uint64_t *hash);
 bool qoi_load_image_header(FILE *fd, qoi_image *image);
+bool qoi_probe_fd(int fd, qoi_header *header);
+bool qoi_probe_file(const char *filepath, qoi_header *header, uint64_t *file_size);
 bool qoi_load_image_data(FILE *fd, qoi_image *image);
 bool qoi_load_image(const char *filepath, qoi_image *image);
 void qoi_free_image(qoi_image *image);
 bool qoi_write_image(const char *filepath, uint32_t width, uint32_t height, uint8_t channels, uint8_t colorspace, qoi_rgba *pixels);
+size_t qoi_max_encoded_size(uint32_t width, uint32_t height, uint8_t channels);
+size_t qoi_encode(void *buffer, size_t buffer_size, uint32_t width, uint32_t height, uint8_t channels, uint8_t colorspace, const qoi_rgba *pixels);
+bool qoi_encode_to_bytes(qoi_bytes *bytes, uint32_t width, uint32_t height, uint8_t channels, uint8_t colorspace, const qoi_rgba *pixels);
+size_t qoi_encode_rgb(void *buffer, size_t buffer_size, uint32_t width, uint32_t height, uint8_t colorspace, const uint8_t *pixels);
+bool qoi_encode_to_bytes_rgb(qoi_bytes *bytes, uint32_t width, uint32_t height, uint8_t colorspace, const uint8_t *pixels);
+size_t qoi_encode_layout(void *buffer, size_t buffer_size, uint32_t width, uint32_t height, uint8_t colorspace, const void *pixels, qoi_layout layout, bool opaque);
+bool qoi_encode_to_bytes_layout(qoi_bytes *bytes, uint32_t width, uint32_t height, uint8_t colorspace, const void *pixels, qoi_layout layout, bool opaque);
+bool qoi_write_image_rgb(const char *filepath, uint32_t width, uint32_t height, uint8_t colorspace, const uint8_t *pixels);
+void qoi_free_bytes(qoi_bytes *bytes);
+bool qoi_encoder_begin(qoi_encoder *encoder, uint32_t width, uint32_t height, uint8_t channels, uint8_t colorspace, qoi_write_func write, void *user);
+bool qoi_encoder_push_rows(qoi_encoder *encoder, const qoi_rgba *pixels, uint32_t rows);
+bool qoi_encoder_finish(qoi_encoder *encoder);
+bool qoi_file_writer(void *file, const void *data, size_t size);
+bool qoi_bytes_writer(void *bytes, const void *data, size_t size);
+bool qoi_encode_to_bytes_indexed(qoi_bytes *bytes, uint32_t width, uint32_t height, uint8_t channels, uint8_t colorspace, const qoi_rgba *pixels, uint32_t rows_per_checkpoint);
+bool qoi_write_image_indexed(const char *filepath, uint32_t width, uint32_t height, uint8_t channels, uint8_t colorspace, qoi_rgba *pixels, uint32_t rows_per_checkpoint);
+size_t qoi_encode_parallel(void *buffer, size_t buffer_size, uint32_t width, uint32_t height, uint8_t channels, uint8_t colorspace, const qoi_rgba *pixels, uint32_t thread_count);
+bool qoi_encode_to_bytes_parallel(qoi_bytes *bytes, uint32_t width, uint32_t height, uint8_t channels, uint8_t colorspace, const qoi_rgba *pixels, uint32_t thread_count);
+bool qoi_write_image_parallel(const char *filepath, uint32_t width, uint32_t height, uint8_t channels, uint8_t colorspace, qoi_rgba *pixels, uint32_t thread_count);
+
+bool qoi_ctx_decode(qoi_ctx *ctx, const void *data, size_t data_size);
+bool qoi_ctx_load_image(qoi_ctx *ctx, const char *filepath);
+bool qoi_ctx_read_file(qoi_ctx *ctx, const char *filepath);
+bool qoi_ctx_encode(qoi_ctx *ctx, uint32_t width, uint32_t height, uint8_t channels, uint8_t colorspace, const qoi_rgba *pixels);
+bool qoi_ctx_write_image(qoi_ctx *ctx, const char *filepath, uint32_t width, uint32_t height, uint8_t channels, uint8_t colorspace, const qoi_rgba *pixels);
+bool qoi_ctx_write_image_layout(qoi_ctx *ctx, const char *filepath, uint32_t width, uint32_t height, uint8_t colorspace, const void *pixels, qoi_layout layout, bool opaque);
+bool qoi_ctx_write_file(qoi_ctx *ctx, const char *filepath);
+void qoi_ctx_free(qoi_ctx *ctx);
+
+uint32_t qoi_cpu_count(void);
+#ifndef QOI_NO_THREADS
+bool qoi_thread_create(qoi_thread *thread, void *(*func)(void *), void *arg);
+void qoi_thread_join(qoi_thread thread);
+void qoi_mutex_init(qoi_mutex *mutex);
+void qoi_mutex_lock(qoi_mutex *mutex);
+void qoi_mutex_unlock(qoi_mutex *mutex);
+void qoi_mutex_destroy(qoi_mutex *mutex);
+void qoi_cond_init(qoi_cond *cond);
+void qoi_cond_wait(qoi_cond *cond, qoi_mutex *mutex);
+void qoi_cond_signal(qoi_cond *cond);
+void qoi_cond_broadcast(qoi_cond *cond);
+void qoi_cond_destroy(qoi_cond *cond);
+#endif
 
 #endif // QOI_HEADER
 #ifdef QOI_IMPLEMENTATION
 
-inline uint8_t qoi_hash(qoi_rgba *color) {
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#endif
+
+// x86-64 builds with GCC or Clang compile the hot loops for every level (target attributes) and
+// pick one at first use from cpuid; the QOI_SIMD environment variable can force a lower level.
+#if (defined(__x86_64__) || defined(_M_X64)) && (defined(__GNUC__) || defined(__clang__)) && !defined(QOI_NO_CPU_DISPATCH)
+#define QOI__CPU_DISPATCH
+#endif
+
+#if defined(__AVX2__) || defined(QOI__CPU_DISPATCH)
+#include <immintrin.h>
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define QOI__SSE2
+#endif
+#if defined(__SSE4_1__) || defined(QOI__CPU_DISPATCH)
+#define QOI__SSE41
+#endif
+#if defined(__AVX2__) || defined(QOI__CPU_DISPATCH)
+#define QOI__AVX2
+#endif
+#if defined(__AVX512BW__) || defined(QOI__CPU_DISPATCH)
+#define QOI__AVX512
+#endif
+
+#ifdef QOI__CPU_DISPATCH
+#define QOI__TARGET_SSE41  __attribute__((target("sse4.1")))
+#define QOI__TARGET_AVX2   __attribute__((target("avx2")))
+#define QOI__TARGET_AVX512 __attribute__((target("avx2,avx512f,avx512bw")))
+#else
+#define QOI__TARGET_SSE41
+#define QOI__TARGET_AVX2
+#define QOI__TARGET_AVX512
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define QOI__UNUSED __attribute__((unused)) // narrower variants the widest one replaces
+#else
+#define QOI__UNUSED
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define QOI__ALWAYS_INLINE inline __attribute__((always_inline)) // so constant arguments specialize each caller
+#elif defined(_MSC_VER)
+#define QOI__ALWAYS_INLINE __forceinline
+#else
+#define QOI__ALWAYS_INLINE inline
+#endif
+
+#ifndef QOI_DECODE_CHUNK
+#define QOI_DECODE_CHUNK 256U
+#endif
+
+#ifndef QOI_DOWNSCALE_MAX
+#define QOI_DOWNSCALE_MAX 4096U // keeps the 32-bit box sums from overflowing
+#endif
+
+#ifndef QOI_READ_CHUNK
+#define QOI_READ_CHUNK 65536U
+#endif
+
+inline uint8_t qoi_hash(const qoi_rgba *color) {
     return (color->r * 3 + color->g * 5 + color->b * 7 + color->a * 11) % 64;
 }
 
-bool freadu32be(FILE *fd, uint32_t *p) {
-    uint8_t buf[4];
-    if (fread(buf, 1, 4, fd) != 4) {
-        return false;
-    }
+static void qoi__write_u32be(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
 
-    *p = (uint32_t)buf[0] << 24 | (uint32_t)buf[1] << 16 | (uint32_t)buf[2] << 8 | (uint32_t)buf[3];
-    return true;
+static uint32_t qoi__ctz(uint32_t x) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, x);
+    return index;
+#else
+    return __builtin_ctz(x);
+#endif
 }
 
-bool fwriteu32be(FILE *fd, uint32_t *p) {
-    uint8_t *temp = (uint8_t *)p;
-    if (!fwrite(&temp[3], 1, 1, fd)) return false;
-    if (!fwrite(&temp[2], 1, 1, fd)) return false;
-    if (!fwrite(&temp[1], 1, 1, fd)) return false;
-    if (!fwrite(&temp[0], 1, 1, fd)) return false;
-    return true;
+// Returns how many of the `count` pixels starting at `pixels` are equal to `px`.
+static size_t qoi__run_length_scalar(const qoi_rgba *pixels, size_t count, qoi_rgba px) {
+    size_t i = 0;
+    for (; i < count && 0 == memcmp(&pixels[i], &px, sizeof(qoi_rgba)); ++i);
+    return i;
 }
 
-bool qoi_load_image_header(FILE *fd, qoi_image* image) {
-    if (fread(&image->header.magic, 1, strlen(QOI_MAGIC), fd) != 4) {
-        fprintf(stderr, "[ERROR]: Couldn't read file magic!\n");
-        return false;
+#ifdef QOI__SSE2
+QOI__UNUSED static size_t qoi__run_length_sse2(const qoi_rgba *pixels, size_t count, qoi_rgba px) {
+    size_t i = 0;
+    uint32_t v;
+    memcpy(&v, &px, sizeof(v));
+    __m128i needle = _mm_set1_epi32(v);
+    for (; i + 4 <= count; i += 4) {
+        uint32_t mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(pixels + i)), needle)));
+        if (mask != 0xF) return i + qoi__ctz(~mask);
     }
-    if (memcmp(image->header.magic, QOI_MAGIC, 4) != 0) {
-        fprintf(stderr, "[ERROR]: Incorrect magic!\n");
-        return false;
+    return i + qoi__run_length_scalar(pixels + i, count - i, px);
+}
+#endif
+
+#ifdef QOI__SSE41
+// One PTEST checks 16 pixels at a time; the SSE2 loop then finds the first different one.
+QOI__TARGET_SSE41 QOI__UNUSED static size_t qoi__run_length_sse41(const qoi_rgba *pixels, size_t count, qoi_rgba px) {
+    size_t i = 0;
+    uint32_t v;
+    memcpy(&v, &px, sizeof(v));
+    __m128i needle = _mm_set1_epi32(v);
+    for (; i + 16 <= count; i += 16) {
+        __m128i a = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(pixels + i)),      needle);
+        __m128i b = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(pixels + i + 4)),  needle);
+        __m128i c = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(pixels + i + 8)),  needle);
+        __m128i d = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(pixels + i + 12)), needle);
+        __m128i diff = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+        if (!_mm_testz_si128(diff, diff)) break;
     }
+    return i + qoi__run_length_sse2(pixels + i, count - i, px);
+}
+#endif
 
-    if (!freadu32be(fd, &image->header.width)) {
-        fprintf(stderr, "[ERROR]: Couldn't read image width!\n");
-        return false;
+#ifdef QOI__AVX2
+QOI__TARGET_AVX2 QOI__UNUSED static size_t qoi__run_length_avx2(const qoi_rgba *pixels, size_t count, qoi_rgba px) {
+    size_t i = 0;
+    uint32_t v;
+    memcpy(&v, &px, sizeof(v));
+    __m256i needle = _mm256_set1_epi32(v);
+    for (; i + 16 <= count; i += 16) {
+        __m256i lo = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *)(pixels + i)), needle);
+        __m256i hi = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *)(pixels + i + 8)), needle);
+        uint32_t mask = _mm256_movemask_ps(_mm256_castsi256_ps(lo)) | _mm256_movemask_ps(_mm256_castsi256_ps(hi)) << 8;
+        if (mask != 0xFFFF) return i + qoi__ctz(~mask);
     }
-    if (!freadu32be(fd, &image->header.height)) {
-        fprintf(stderr, "[ERROR]: Couldn't read image height!\n");
-        return false;
+    for (; i + 8 <= count; i += 8) {
+        uint32_t mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *)(pixels + i)), needle)));
+        if (mask != 0xFF) return i + qoi__ctz(~mask);
     }
-    if (fread(&image->header.channels, 1, 1, fd) != 1) {
-        fprintf(stderr, "[ERROR]: Couldn't read image channels!\n");
-        return false;
+    return i + qoi__run_length_scalar(pixels + i, count - i, px);
+}
+#endif
+
+#ifdef QOI__AVX512
+QOI__TARGET_AVX512 static size_t qoi__run_length_avx512(const qoi_rgba *pixels, size_t count, qoi_rgba px) {
+    size_t i = 0;
+    uint32_t v;
+    memcpy(&v, &px, sizeof(v));
+    __m512i needle = _mm512_set1_epi32(v);
+    for (; i + 16 <= count; i += 16) {
+        uint32_t mask = _mm512_cmpeq_epi32_mask(_mm512_loadu_si512((const void *)(pixels + i)), needle);
+        if (mask != 0xFFFF) return i + qoi__ctz(~mask);
     }
-    if (fread(&image->header.colorspace, 1, 1, fd) != 1) {
-        fprintf(stderr, "[ERROR]: Couldn't read image colorspace!\n");
-        return false;
+    return i + qoi__run_length_avx2(pixels + i, count - i, px);
+}
+#endif
+
+#ifdef __ARM_NEON
+static size_t qoi__run_length_neon(const qoi_rgba *pixels, size_t count, qoi_rgba px) {
+    size_t i = 0;
+    uint32_t v;
+    memcpy(&v, &px, sizeof(v));
+    uint32x4_t needle = vdupq_n_u32(v);
+    for (; i + 4 <= count; i += 4) {
+        uint32x4_t eq = vceqq_u32(vld1q_u32((const uint32_t *)(pixels + i)), needle);
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u16(vmovn_u32(eq)), 0);
+        if (mask != UINT64_MAX) break;
     }
+    return i + qoi__run_length_scalar(pixels + i, count - i, px);
+}
+#endif
 
-    return true;
+// Widest implementation the build targets when nothing is dispatched at runtime
+#if defined(QOI__CPU_DISPATCH)
+#elif defined(__AVX512BW__)
+#define qoi__run_length qoi__run_length_avx512
+#elif defined(__AVX2__)
+#define qoi__run_length qoi__run_length_avx2
+#elif defined(__SSE4_1__)
+#define qoi__run_length qoi__run_length_sse41
+#elif defined(QOI__SSE2)
+#define qoi__run_length qoi__run_length_sse2
+#elif defined(__ARM_NEON)
+#define qoi__run_length qoi__run_length_neon
+#else
+#define qoi__run_length qoi__run_length_scalar
+#endif
+
+static void qoi__state_init(qoi_state *state) {
+    memset(state, 0, sizeof(*state));
+    state->prev_px.a = 255;
 }
 
-bool qoi_load_image_data(FILE *fd, qoi_image* image) {
-    if (fseek(fd, 0, SEEK_END) < 0) {
-        fprintf(stderr, "[ERROR]: Couldn't jump to end of file!\n");
+#ifndef QOI_NO_THREADS
+#ifdef _WIN32
+typedef struct {
+    void *(*func)(void *);
+    void *arg;
+} qoi__thread_start;
+
+static DWORD WINAPI qoi__thread_main(LPVOID param) {
+    qoi__thread_start start = *(qoi__thread_start *)param;
+    QOI_Free(param);
+    start.func(start.arg);
+    return 0;
+}
+
+bool qoi_thread_create(qoi_thread *thread, void *(*func)(void *), void *arg) {
+    qoi__thread_start *start = QOI_Malloc(sizeof(*start));
+    if (start == NULL) return false;
+
+    start->func = func;
+    start->arg = arg;
+    *thread = CreateThread(NULL, 0, qoi__thread_main, start, 0, NULL);
+    if (*thread == NULL) {
+        QOI_Free(start);
         return false;
     }
-#ifndef _WIN32
-    long data_size = ftell(fd);
+
+    return true;
+}
+
+void qoi_thread_join(qoi_thread thread) {
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+void qoi_mutex_init(qoi_mutex *mutex) {
+    InitializeCriticalSection(mutex);
+}
+
+void qoi_mutex_lock(qoi_mutex *mutex) {
+    EnterCriticalSection(mutex);
+}
+
+void qoi_mutex_unlock(qoi_mutex *mutex) {
+    LeaveCriticalSection(mutex);
+}
+
+void qoi_mutex_destroy(qoi_mutex *mutex) {
+    DeleteCriticalSection(mutex);
+}
+
+void qoi_cond_init(qoi_cond *cond) {
+    InitializeConditionVariable(cond);
+}
+
+void qoi_cond_wait(qoi_cond *cond, qoi_mutex *mutex) {
+    SleepConditionVariableCS(cond, mutex, INFINITE);
+}
+
+void qoi_cond_signal(qoi_cond *cond) {
+    WakeConditionVariable(cond);
+}
+
+void qoi_cond_broadcast(qoi_cond *cond) {
+    WakeAllConditionVariable(cond);
+}
+
+void qoi_cond_destroy(qoi_cond *cond) {
+    (void)cond; // condition variables hold no resources on Windows
+}
 #else
-    long long data_size = _ftelli64(fd);
+bool qoi_thread_create(qoi_thread *thread, void *(*func)(void *), void *arg) {
+    return pthread_create(thread, NULL, func, arg) == 0;
+}
+
+void qoi_thread_join(qoi_thread thread) {
+    pthread_join(thread, NULL);
+}
+
+void qoi_mutex_init(qoi_mutex *mutex) {
+    pthread_mutex_init(mutex, NULL);
+}
+
+void qoi_mutex_lock(qoi_mutex *mutex) {
+    pthread_mutex_lock(mutex);
+}
+
+void qoi_mutex_unlock(qoi_mutex *mutex) {
+    pthread_mutex_unlock(mutex);
+}
+
+void qoi_mutex_destroy(qoi_mutex *mutex) {
+    pthread_mutex_destroy(mutex);
+}
+
+void qoi_cond_init(qoi_cond *cond) {
+    pthread_cond_init(cond, NULL);
+}
+
+void qoi_cond_wait(qoi_cond *cond, qoi_mutex *mutex) {
+    pthread_cond_wait(cond, mutex);
+}
+
+void qoi_cond_signal(qoi_cond *cond) {
+    pthread_cond_signal(cond);
+}
+
+void qoi_cond_broadcast(qoi_cond *cond) {
+    pthread_cond_broadcast(cond);
+}
+
+void qoi_cond_destroy(qoi_cond *cond) {
+    pthread_cond_destroy(cond);
+}
 #endif
-    data_size -= QOI_HEADER_SIZE + QOI_END_SIZE;
-    uint8_t *data = (uint8_t*)QOI_Malloc(data_size);
-    
-    if (data == NULL) {
-        fprintf(stderr, "[ERROR]: Couldn't allocate space for data (size: %zu)!\n", data_size);
-        return false;
-    }
-    memset(data, 0, data_size);
-    
-    fseek(fd, QOI_HEADER_SIZE, SEEK_SET);
-    size_t data_read_count = fread(data, 1, data_size, fd);
-#ifndef _WIN32
-    if ((long) data_read_count < data_size) {
+#endif // QOI_NO_THREADS
+
+uint32_t qoi_cpu_count(void) {
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
 #else
-    if ((long long) data_read_count < data_size) {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (uint32_t)count : 1;
 #endif
-        fprintf(stderr, "[ERROR]: Read data size (%zu) doesn't match seeked size (%zu)!\n", data_read_count, data_size);
-        return false;
+}
+
+// Runs `func` over `count` items on up to `thread_count` threads, item i going to thread i % thread_count.
+// The calling thread takes a share too; without thread support everything runs on it.
+typedef struct {
+    void    (*func)(void *item);
+    uint8_t  *items;
+    size_t    item_size;
+    uint32_t  count;
+    uint32_t  first;
+    uint32_t  step;
+} qoi__parallel_job;
+
+static void *qoi__parallel_worker(void *arg) {
+    qoi__parallel_job *job = arg;
+    for (uint32_t i = job->first; i < job->count; i += job->step) {
+        job->func(job->items + i * job->item_size);
     }
-    
-    uint8_t end[QOI_END_SIZE];
-    size_t read_end_size = fread(end, 1, QOI_END_SIZE, fd);
-    if (QOI_END_SIZE > read_end_size) {
-        fprintf(stderr, "[ERROR]: Read end size (%zu) doesn't match expected end size (%u)!\n", read_end_size, QOI_END_SIZE);
-        return false;
+    return NULL;
+}
+
+static void qoi__parallel_for(void (*func)(void *item), void *items, size_t item_size, uint32_t count, uint32_t thread_count) {
+    if (thread_count > QOI_MAX_THREADS) thread_count = QOI_MAX_THREADS;
+    if (thread_count > count) thread_count = count;
+    if (thread_count == 0) thread_count = 1;
+
+    qoi__parallel_job jobs[QOI_MAX_THREADS];
+    for (uint32_t t = 0; t < thread_count; ++t) {
+        jobs[t] = (qoi__parallel_job) { func, items, item_size, count, t, thread_count };
     }
-    if (0 != memcmp(QOI_END, end, QOI_END_SIZE)) {
-        fprintf(stderr, "[ERROR]: Incorrect end magic!\n");
-        return false;
+
+#ifndef QOI_NO_THREADS
+    qoi_thread threads[QOI_MAX_THREADS];
+    bool started[QOI_MAX_THREADS];
+    for (uint32_t t = 1; t < thread_count; ++t) {
+        started[t] = qoi_thread_create(&threads[t], qoi__parallel_worker, &jobs[t]);
+        if (!started[t]) qoi__parallel_worker(&jobs[t]);
+    }
+    qoi__parallel_worker(&jobs[0]);
+    for (uint32_t t = 1; t < thread_count; ++t) {
+        if (started[t]) qoi_thread_join(threads[t]);
+    }
+#else
+    for (uint32_t t = 0; t < thread_count; ++t) {
+        qoi__parallel_worker(&jobs[t]);
     }
+#endif
+}
 
-    qoi_da_reserve(&image->image_data, image->header.width * image->header.height + 1);
+static uint32_t qoi__read_u32be(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
 
-    qoi_rgba lookup_array[64] = {0};
-    qoi_rgba prev_px = { 0, 0, 0, 255 };
+bool qoi_decode_header(const void *data, size_t data_size, qoi_header *header) {
+    const uint8_t *bytes = data;
+    if (data_size < QOI_HEADER_SIZE) {
+        fprintf(stderr, "[ERROR]: Data size (%zu) is smaller than the header size (%u)!\n", data_size, QOI_HEADER_SIZE);
+        return false;
+    }
+    if (memcmp(bytes, QOI_MAGIC, 4) != 0) {
+        fprintf(stderr, "[ERROR]: Incorrect magic!\n");
+        return false;
+    }
 
-    for (;image->image_data.count < image->header.width * image->header.height; data++) {
-        lookup_array[qoi_hash(&prev_px)] = prev_px;
+    memcpy(header->magic, bytes, 4);
+    header->width      = qoi__read_u32be(bytes + 4);
+    header->height     = qoi__read_u32be(bytes + 8);
+    header->channels   = bytes[12];
+    header->colorspace = bytes[13];
 
-        if (*data == RGBA) {
-            prev_px.r = *++data;
-            prev_px.g = *++data;
-            prev_px.b = *++data;
-            prev_px.a = *++data;
-        }
-        else if (*data == RGB) {
-            prev_px.r = *++data;
-            prev_px.g = *++data;
-            prev_px.b = *++data;
-        }
-        else if ((*data & 0b11000000) == INDEX) {
-            uint8_t index = 0b00111111 & *data;
-            prev_px = lookup_array[index];
-        }
-        else if ((*data & 0b11000000) == DIFF) {
-            prev_px.r += ((*data >> 4) & 0b00000011) - 2;
-            prev_px.g += ((*data >> 2) & 0b00000011) - 2;
-            prev_px.b += (*data & 0b00000011)        - 2;
-        }
-        else if ((*data & 0b11000000) == LUMA) {
-            int8_t dg    = (*data++ & 0b00111111)    - 32;
-            int8_t dr_dg = (*data >> 4 & 0b00001111) - 8;
-            int8_t db_dg = (*data & 0b00001111)      - 8;
+    return true;
+}
 
-            prev_px.r += dr_dg + dg;
-            prev_px.g += dg;
-            prev_px.b += db_dg + dg;
-        }
-        else if ((*data & 0b11000000) == RUN) {
-            uint8_t times = (*data & 0b00111111);
-            for(uint8_t repeat = 0; repeat <= times; ++repeat) {
-                qoi_da_append(&image->image_data, prev_px);
-            }
-            continue;
-        }
-        
-        qoi_da_append(&image->image_data, prev_px);
+// Header parsing only checks structure, so probing works on any size; the paths that allocate
+// pixels for a whole image reject images over QOI_PIXELS_MAX with this.
+static bool qoi__check_pixel_count(uint32_t width, uint32_t height) {
+    if ((size_t)width * height > QOI_PIXELS_MAX) {
+        fprintf(stderr, "[ERROR]: Image size (%ux%u) exceeds the maximum pixel count!\n", width, height);
+        return false;
     }
-    
     return true;
 }
 
-bool qoi_load_image(const char* filepath, qoi_image* image) {
-    FILE *fd = fopen(filepath, "rb");
-
-    if (NULL == fd) {
-        fprintf(stderr, "[ERROR]: Couldn't open file %s!\n", filepath);
+bool qoi_load_image_header(FILE *fd, qoi_image* image) {
+    uint8_t header[QOI_HEADER_SIZE];
+    if (fread(header, 1, QOI_HEADER_SIZE, fd) != QOI_HEADER_SIZE) {
+        fprintf(stderr, "[ERROR]: Couldn't read image header!\n");
         return false;
     }
-    if (!qoi_load_image_header(fd, image)) {
-        fprintf(stderr, "[ERROR]: Incorrect header data!\n");
-        goto error;
-    }
-    if (!qoi_load_image_data(fd, image)) {
-        fprintf(stderr, "[ERROR]: Incorrect image data!\n");
-        goto error;
+
+    return qoi_decode_header(header, QOI_HEADER_SIZE, &image->header);
+}
+
+// Checks the end marker and returns the end of the op stream that precedes it.
+static const uint8_t *qoi__data_end(const uint8_t *data, size_t data_size) {
+    if (data_size < QOI_END_SIZE) {
+        fprintf(stderr, "[ERROR]: Data size (%zu) is smaller than the end size (%u)!\n", data_size, QOI_END_SIZE);
+        return NULL;
     }
-    if (image->header.width * image->header.height != image->image_data.count) {
-        fprintf(stderr, "[ERROR]: Image width (%u) and heigth (%u) doesn't match parsed pixel count (%u)!\n", image->header.width, image->header.height, image->image_data.count);
-        goto error;
+    const uint8_t *data_end = data + data_size - QOI_END_SIZE;
+    if (0 != memcmp(QOI_END, data_end, QOI_END_SIZE)) {
+        fprintf(stderr, "[ERROR]: Incorrect end magic!\n");
+        return NULL;
     }
-    
-    fclose(fd);
-    return true;
 
-error:
-    fclose(fd);
-    return false;
+    return data_end;
 }
 
-void qoi_free_image(qoi_image* image) {
-    QOI_Free(image->image_data.items);
+typedef struct {
+    const uint8_t *checkpoints;
+    uint32_t count;
+    uint32_t rows;
+} qoi__index;
+
+// Splits a trailing seek index off the stream and returns the size of the stream without it.
+// `min_size` is what has to remain in front of the index for it to be considered.
+static size_t qoi__find_index(const uint8_t *data, size_t data_size, size_t min_size, qoi__index *index) {
+    memset(index, 0, sizeof(*index));
+    if (data_size < QOI_INDEX_FOOTER_SIZE || memcmp(data + data_size - 4, QOI_INDEX_MAGIC, 4) != 0) {
+        return data_size;
+    }
+
+    const uint8_t *footer = data + data_size - QOI_INDEX_FOOTER_SIZE;
+    uint32_t count = qoi__read_u32be(footer);
+    size_t index_size = (size_t)count * QOI_CHECKPOINT_SIZE + QOI_INDEX_FOOTER_SIZE;
+    if (index_size + min_size > data_size) return data_size;
+
+    index->checkpoints = data + data_size - index_size;
+    index->count       = count;
+    index->rows        = qoi__read_u32be(footer + 4);
+    return data_size - index_size;
 }
 
-bool qoi_write_image(const char* filepath, uint32_t width, uint32_t height, uint8_t channels, uint8_t colorspace, qoi_rgba* pixels) {
-    FILE *fd = fopen(filepath, "wb");
+// Restores the decoder state saved in a checkpoint; `data` is the start of the file.
+static bool qoi__resume_checkpoint(const uint8_t *checkpoint, const uint8_t *data, const uint8_t *data_end, qoi_state *state, const uint8_t **ops) {
+    uint32_t offset = qoi__read_u32be(checkpoint);
+    uint8_t skip = checkpoint[4];
+    if (offset < QOI_HEADER_SIZE || offset > (size_t)(data_end - data)) return false;
 
-    if (NULL == fd) {
-        fprintf(stderr, "[ERROR]: Couldn't open file: %s\n", filepath);
-        return false;
-    }
+    memcpy(&state->prev_px, checkpoint + 5, sizeof(qoi_rgba));
+    memcpy(state->lookup_array, checkpoint + 9, sizeof(state->lookup_array));
+    state->lookup_array[qoi_hash(&state->prev_px)] = state->prev_px;
+    state->run = 0;
 
-    fwrite(QOI_MAGIC, strlen(QOI_MAGIC), 1, fd);
-    fwriteu32be(fd, &width);
-    fwriteu32be(fd, &height);
-    fwrite(&channels, sizeof(channels), 1, fd);
-    fwrite(&colorspace, sizeof(colorspace), 1, fd);
-    
-    qoi_rgba lookup_array[64] = {0};
-    qoi_rgba prev_px = { 0, 0, 0, 255 };
-    qoi_rgba *pixels_end = &pixels[width * height];
-    
-    uint8_t type, hash;
-    int8_t dr, dg, db, dr_dg, db_dg;
-    for (;pixels < pixels_end; ++pixels) {
-        hash = qoi_hash(pixels);
-        
-        if (0 == memcmp(pixels, &prev_px, sizeof(qoi_rgba))) { // RUN
-            for (type = RUN - 1;pixels < pixels_end && 0 == memcmp(pixels, &prev_px, sizeof(qoi_rgba)); ++type, ++pixels) {
-                if (type == RGB - 1) {
-                    fwrite(&type, sizeof(type), 1, fd);
-                    type = RUN - 1;
-                }
-            }
-            fwrite(&type, sizeof(type), 1, fd);
-            --pixels;
-        }
-        else if (0 == memcmp(&lookup_array[hash], pixels, sizeof(qoi_rgba))) { // INDEX
-            fwrite(&hash, sizeof(hash), 1, fd);
-        }
-        else if (pixels->a != prev_px.a) { // RGBA
-            type = RGBA;
-            fwrite(&type, sizeof(type), 1, fd);
-            fwrite(pixels, sizeof(qoi_rgba), 1, fd);
-        }
-        else {
-            dr = pixels->r - prev_px.r;
-            dg = pixels->g - prev_px.g;
-            db = pixels->b - prev_px.b;
-            dr_dg = dr - dg;
-            db_dg = db - dg;
-            
-            if (qoi_between(dr, -2, 1) && qoi_between(dg, -2, 1) && qoi_between(db, -2, 1)) { // DIFF
-                type = DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
-                fwrite(&type, sizeof(type), 1, fd);
-            }
-            else if (qoi_between(dg, -32, 31) && qoi_between(dr_dg, -8, 7) && qoi_between(db_dg, -8, 7)) { // LUMA
-                uint8_t luma[] = { LUMA | (dg + 32), (dr_dg + 8) << 4 | (db_dg + 8) };
-                fwrite(luma, sizeof(luma), 1, fd);
-            }
-            else if (pixels->a == prev_px.a) { // RGB
-                type = RGB;
-                fwrite(&type, sizeof(type), 1, fd);
-                fwrite(pixels, sizeof(qoi_rgba) - sizeof(pixels->a), 1, fd);
-            }
-        }
-        
-        prev_px = *pixels;
-        lookup_array[hash] = prev_px;
+    *ops = data + offset;
+    if (skip > 0) {
+        // the row starts inside a RUN op
+        if (*ops >= data_end) return false;
+        uint8_t op = *(*ops)++;
+        if ((op & 0b11000000) != RUN || op >= RGB || (op & 0b00111111) + 1 < skip) return false;
+        state->run = (op & 0b00111111) + 1 - skip;
     }
 
-    fwrite(QOI_END, QOI_END_SIZE, 1, fd);
-    fclose(fd);
     return true;
 }
 
+// Writes `count` copies of `px` with the widest stores available.
+static void qoi__fill_pixels_scalar(qoi_rgba *pixels, size_t count, qoi_rgba px) {
+    for (size_t i = 0; i < count; ++i) pixels[i] = px;
+}
+
+#ifdef QOI__SSE2
+QOI__UNUSED static void qoi__fill_pixels_sse2(qoi_rgba *pixels, size_t count, qoi_rgba px) {
+    size_t i = 0;
+    uint32_t v;
+    memcpy(&v, &px, sizeof(v));
+    __m128i wide = _mm_set1_epi32(v);
+    for (; i + 4 <= count; i += 4) _mm_storeu_si128((__m128i *)(pixels + i), wide);
+    qoi__fill_pixels_scalar(pixels + i, count - i, px);
+}
+#endif
+
+#ifdef QOI__AVX2
+QOI__TARGET_AVX2 QOI__UNUSED static void qoi__fill_pixels_avx2(qoi_rgba *pixels, size_t count, qoi_rgba px) {
+    size_t i = 0;
+    uint32_t v;
+    memcpy(&v, &px, sizeof(v));
+    __m256i wide = _mm256_set1_epi32(v);
+    for (; i + 8 <= count; i += 8) _mm256_storeu_si256((__m256i *)(pixels + i), wide);
+    if (i + 4 <= count) {
+        _mm_storeu_si128((__m128i *)(pixels + i), _mm256_castsi256_si128(wide));
+        i += 4;
+    }
+    qoi__fill_pixels_scalar(pixels + i, count - i, px);
+}
+#endif
+
+#ifdef QOI__AVX512
+QOI__TARGET_AVX512 static void qoi__fill_pixels_avx512(qoi_rgba *pixels, size_t count, qoi_rgba px) {
+    size_t i = 0;
+    uint32_t v;
+    memcpy(&v, &px, sizeof(v));
+    __m512i wide = _mm512_set1_epi32(v);
+    for (; i + 16 <= count; i += 16) _mm512_storeu_si512((void *)(pixels + i), wide);
+    if (i < count) _mm512_mask_storeu_epi32((void *)(pixels + i), (__mmask16)((1U << (count - i)) - 1), wide);
+}
+#endif
+
+#ifdef __ARM_NEON
+static void qoi__fill_pixels_neon(qoi_rgba *pixels, size_t count, qoi_rgba px) {
+    size_t i = 0;
+    uint32_t v;
+    memcpy(&v, &px, sizeof(v));
+    uint32x4_t wide = vdupq_n_u32(v);
+    for (; i + 4 <= count; i += 4) vst1q_u32((uint32_t *)(pixels + i), wide);
+    qoi__fill_pixels_scalar(pixels + i, count - i, px);
+}
+#endif
+
+QOI__UNUSED static void qoi__fill_rgb(uint8_t *out, size_t count, qoi_rgba px) {
+    for (uint8_t *out_end = out + count * 3; out < out_end; out += 3) {
+        out[0] = px.r;
+        out[1] = px.g;
+        out[2] = px.b;
+    }
+}
+
+#ifdef QOI__SSE41
+// Three byte shuffles of the color make the 48 bytes of 16 RGB pixels.
+QOI__TARGET_SSE41 QOI__UNUSED static void qoi__fill_rgb_sse41(uint8_t *out, size_t count, qoi_rgba px) {
+    size_t i = 0;
+    uint32_t v;
+    memcpy(&v, &px, sizeof(v));
+    __m128i color = _mm_cvtsi32_si128((int)v);
+    __m128i first  = _mm_shuffle_epi8(color, _mm_setr_epi8(0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0));
+    __m128i second = _mm_shuffle_epi8(color, _mm_setr_epi8(1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1));
+    __m128i third  = _mm_shuffle_epi8(color, _mm_setr_epi8(2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2));
+    for (; i + 16 <= count; i += 16, out += 48) {
+        _mm_storeu_si128((__m128i *)out,        first);
+        _mm_storeu_si128((__m128i *)(out + 16), second);
+        _mm_storeu_si128((__m128i *)(out + 32), third);
+    }
+    qoi__fill_rgb(out, count - i, px);
+}
+#endif
+
+#if defined(QOI__CPU_DISPATCH)
+#elif defined(__AVX512BW__)
+#define qoi__fill_pixels qoi__fill_pixels_avx512
+#elif defined(__AVX2__)
+#define qoi__fill_pixels qoi__fill_pixels_avx2
+#elif defined(QOI__SSE2)
+#define qoi__fill_pixels qoi__fill_pixels_sse2
+#elif defined(__ARM_NEON)
+#define qoi__fill_pixels qoi__fill_pixels_neon
+#else
+#define qoi__fill_pixels qoi__fill_pixels_scalar
+#endif
+
+#if defined(QOI__CPU_DISPATCH)
+#elif defined(__SSE4_1__)
+#define qoi__fill_rgb_wide qoi__fill_rgb_sse41
+#else
+#define qoi__fill_rgb_wide qoi__fill_rgb
+#endif
+
+#define QOI__X2(x)  x, x
+#define QOI__X4(x)  QOI__X2(x),  QOI__X2(x)
+#define QOI__X8(x)  QOI__X4(x),  QOI__X4(x)
+#define QOI__X16(x) QOI__X8(x),  QOI__X8(x)
+#define QOI__X32(x) QOI__X16(x), QOI__X16(x)
+#define QOI__X62(x) QOI__X32(x), QOI__X16(x), QOI__X8(x), QOI__X4(x), QOI__X2(x)
+#define QOI__X64(x) QOI__X32(x), QOI__X32(x)
+#define QOI__OP_TABLE(index, diff, luma, run, rgb, rgba) { QOI__X64(index), QOI__X64(diff), QOI__X64(luma), QOI__X62(run), rgb, rgba }
+
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(QOI_NO_COMPUTED_GOTO)
+#define QOI__COMPUTED_GOTO
+#define QOI__DISPATCH_TABLE() static const void *const ops[256] = QOI__OP_TABLE(&&op_INDEX, &&op_DIFF, &&op_LUMA, &&op_RUN, &&op_RGB, &&op_RGBA);
+#define QOI__DISPATCH() goto *ops[*data];
+#define QOI__OP(kind) op_##kind
+#else
+typedef enum { QOI__OP_INDEX, QOI__OP_DIFF, QOI__OP_LUMA, QOI__OP_RUN, QOI__OP_RGB, QOI__OP_RGBA } qoi__op_kind;
+static const uint8_t qoi__op_kinds[256] = QOI__OP_TABLE(QOI__OP_INDEX, QOI__OP_DIFF, QOI__OP_LUMA, QOI__OP_RUN, QOI__OP_RGB, QOI__OP_RGBA);
+#define QOI__DISPATCH_TABLE()
+#define QOI__DISPATCH() switch (qoi__op_kinds[*data])
+#define QOI__OP(kind) case QOI__OP_##kind
+#endif
+
+static size_t qoi__op_size(uint8_t op) {
+    if (op == RGBA) return 5;
+    if (op == RGB) return 4;
+    if ((op & 0b11000000) == LUMA) return 2;
+    return 1;
+}
+
+// Defines a decode core writing `pixel_type` elements, `step` of them per pixel, through
+// `put(out, swizzle(px))` and `fill(out, count, swizzle(px))`, so each output layout and instruction
+// set gets its own loop; `target` holds the function attributes of the instruction set.
+// The core decodes the complete ops in [*data_ptr, data_end) into at most `count` pixels; an op
+// that doesn't fit in the input is left unread. While every op is known to fit (5 bytes in,
+// 62 pixels out) ops run without checks; only the last few are checked one by one.
+// Every decoded pixel enters the index once, right after the op that produced it.
+#define QOI__DEFINE_DECODE_PIXELS(name, target, pixel_type, step, swizzle, put, fill)                       \
+target static size_t name(qoi_state *state, const uint8_t **data_ptr, const uint8_t *data_end, pixel_type *pixels, size_t count) { \
+    QOI__DISPATCH_TABLE()                                                                                   \
+    const uint8_t *data = *data_ptr;                                                                        \
+    pixel_type *pixels_start = pixels;                                                                      \
+    pixel_type *pixels_end = pixels + count * (step);                                                       \
+    qoi_rgba prev_px = state->prev_px;                                                                      \
+    uint32_t run = state->run;                                                                              \
+                                                                                                            \
+    state->lookup_array[qoi_hash(&prev_px)] = prev_px;                                                      \
+                                                                                                            \
+    for (;;) {                                                                                              \
+        size_t left = (size_t)(pixels_end - pixels) / (step);                                               \
+        if (run > 0) {                                                                                      \
+            size_t length = left < run ? left : run;                                                        \
+            fill(pixels, length, swizzle(prev_px));                                                         \
+            pixels += length * (step);                                                                      \
+            left -= length;                                                                                 \
+            run -= length;                                                                                  \
+        }                                                                                                   \
+                                                                                                            \
+        size_t safe_ops = (size_t)(data_end - data) / 5;                                                    \
+        if (left / 62 < safe_ops) safe_ops = left / 62;                                                     \
+        if (safe_ops == 0) {                                                                                \
+            if (left == 0 || data >= data_end || (size_t)(data_end - data) < qoi__op_size(*data)) break;    \
+            safe_ops = 1;                                                                                   \
+        }                                                                                                   \
+                                                                                                            \
+        do {                                                                                                \
+            QOI__DISPATCH() {                                                                               \
+            QOI__OP(INDEX):                                                                                 \
+                prev_px = state->lookup_array[*data++];                                                     \
+                goto pixel;                                                                                 \
+            QOI__OP(DIFF):                                                                                  \
+                prev_px.r += ((*data >> 4) & 0b00000011) - 2;                                               \
+                prev_px.g += ((*data >> 2) & 0b00000011) - 2;                                               \
+                prev_px.b += (*data & 0b00000011)        - 2;                                               \
+                data++;                                                                                     \
+                goto pixel;                                                                                 \
+            QOI__OP(LUMA): {                                                                                \
+                int8_t dg    = (*data++ & 0b00111111)    - 32;                                              \
+                int8_t dr_dg = (*data >> 4 & 0b00001111) - 8;                                               \
+                int8_t db_dg = (*data & 0b00001111)      - 8;                                               \
+                data++;                                                                                     \
+                                                                                                            \
+                prev_px.r += dr_dg + dg;                                                                    \
+                prev_px.g += dg;                                                                            \
+                prev_px.b += db_dg + dg;                                                                    \
+                goto pixel;                                                                                 \
+            }                                                                                               \
+            QOI__OP(RUN):                                                                                   \
+                run = (*data++ & 0b00111111) + 1;                                                           \
+                if ((size_t)(pixels_end - pixels) / (step) >= run) {                                        \
+                    fill(pixels, run, swizzle(prev_px));                                                    \
+                    pixels += run * (step);                                                                 \
+                    run = 0;                                                                                \
+                }                                                                                           \
+                continue;                                                                                   \
+            QOI__OP(RGB):                                                                                   \
+                prev_px.r = data[1];                                                                        \
+                prev_px.g = data[2];                                                                        \
+                prev_px.b = data[3];                                                                        \
+                data += 4;                                                                                  \
+                goto pixel;                                                                                 \
+            QOI__OP(RGBA):                                                                                  \
+                memcpy(&prev_px, data + 1, sizeof(qoi_rgba));                                               \
+                data += 5;                                                                                  \
+                goto pixel;                                                                                 \
+            }                                                                                               \
+                                                                                                            \
+        pixel:                                                                                              \
+            state->lookup_array[qoi_hash(&prev_px)] = prev_px;                                              \
+            put(pixels, swizzle(prev_px));                                                                  \
+            pixels += (step);                                                                               \
+        } while (--safe_ops > 0);                                                                           \
+    }                                                                                                       \
+                                                                                                            \
+    *data_ptr = data;                                                                                       \
+    state->prev_px = prev_px;                                                                               \
+    state->run = run;                                                                                       \
+    return (pixels - pixels_start) / (step);                                                                \
+}
+
+#define QOI__RGBA(px) (px)
+#define QOI__BGRA(px) ((qoi_rgba){ .r = (px).b, .g = (px).g, .b = (px).r, .a = (px).a }) // BGRA bytes in a qoi_rgba slot
+#define QOI__ARGB(px) ((qoi_rgba){ .r = (px).a, .g = (px).r, .b = (px).g, .a = (px).b })
+#define QOI__PUT_PIXEL(out, px) (*(out) = (px))
+#define QOI__PUT_RGB(out, px)   ((out)[0] = (px).r, (out)[1] = (px).g, (out)[2] = (px).b)
+
+#ifdef QOI__CPU_DISPATCH
+// The RGBA, RGB, BGRA and ARGB decode cores of one instruction set.
+#define QOI__DEFINE_DECODE_CORES(level, target, fill, fill_rgb)                                               \
+QOI__DEFINE_DECODE_PIXELS(qoi__decode_core_##level, target, qoi_rgba, 1, QOI__RGBA, QOI__PUT_PIXEL, fill)     \
+QOI__DEFINE_DECODE_PIXELS(qoi__decode_rgb_##level,  target, uint8_t,  3, QOI__RGBA, QOI__PUT_RGB,   fill_rgb) \
+QOI__DEFINE_DECODE_PIXELS(qoi__decode_bgra_##level, target, qoi_rgba, 1, QOI__BGRA, QOI__PUT_PIXEL, fill)     \
+QOI__DEFINE_DECODE_PIXELS(qoi__decode_argb_##level, target, qoi_rgba, 1, QOI__ARGB, QOI__PUT_PIXEL, fill)
+
+QOI__DEFINE_DECODE_CORES(scalar, ,                   qoi__fill_pixels_scalar, qoi__fill_rgb)
+QOI__DEFINE_DECODE_CORES(sse2,   ,                   qoi__fill_pixels_sse2,   qoi__fill_rgb)
+QOI__DEFINE_DECODE_CORES(sse41,  QOI__TARGET_SSE41,  qoi__fill_pixels_sse2,   qoi__fill_rgb_sse41)
+QOI__DEFINE_DECODE_CORES(avx2,   QOI__TARGET_AVX2,   qoi__fill_pixels_avx2,   qoi__fill_rgb_sse41)
+QOI__DEFINE_DECODE_CORES(avx512, QOI__TARGET_AVX512, qoi__fill_pixels_avx512, qoi__fill_rgb_sse41)
+
+typedef struct {
+    size_t (*decode_pixels)(qoi_state *state, const uint8_t **data_ptr, const uint8_t *data_end, qoi_rgba *pixels, size_t count);
+    size_t (*decode_rgb)(qoi_state *state, const uint8_t **data_ptr, const uint8_t *data_end, uint8_t *pixels, size_t count);
+    size_t (*decode_bgra)(qoi_state *state, const uint8_t **data_ptr, const uint8_t *data_end, qoi_rgba *pixels, size_t count);
+    size_t (*decode_argb)(qoi_state *state, const uint8_t **data_ptr, const uint8_t *data_end, qoi_rgba *pixels, size_t count);
+    uint8_t *(*encode_pixels)(qoi_state *state, const qoi_rgba *pixels, size_t count, uint8_t *out, uint8_t *out_end);
+    uint8_t *(*encode_opaque)(qoi_state *state, const qoi_rgba *pixels, size_t count, uint8_t *out, uint8_t *out_end);
+    void (*linearize)(qoi_rgba *pixels, size_t count);
+    size_t (*run_length)(const qoi_rgba *pixels, size_t count, qoi_rgba px);
+} qoi__kernel_table;
+
+static const qoi__kernel_table *qoi__kernels(void);
+
+static size_t qoi__decode_pixels(qoi_state *state, const uint8_t **data_ptr, const uint8_t *data_end, qoi_rgba *pixels, size_t count) {
+    return qoi__kernels()->decode_pixels(state, data_ptr, data_end, pixels, count);
+}
+
+static size_t qoi__run_length(const qoi_rgba *pixels, size_t count, qoi_rgba px) {
+    return qoi__kernels()->run_length(pixels, count, px);
+}
+
+#ifndef QOI_GENERIC_ONLY
+static size_t qoi__decode_pixels_rgb(qoi_state *state, const uint8_t **data_ptr, const uint8_t *data_end, uint8_t *pixels, size_t count) {
+    return qoi__kernels()->decode_rgb(state, data_ptr, data_end, pixels, count);
+}
+
+static size_t qoi__decode_pixels_bgra(qoi_state *state, const uint8_t **data_ptr, const uint8_t *data_end, qoi_rgba *pixels, size_t count) {
+    return qoi__kernels()->decode_bgra(state, data_ptr, data_end, pixels, count);
+}
+
+static size_t qoi__decode_pixels_argb(qoi_state *state, const uint8_t **data_ptr, const uint8_t *data_end, qoi_rgba *pixels, size_t count) {
+    return qoi__kernels()->decode_argb(state, data_ptr, data_end, pixels, count);
+}
+#endif
+#else
+QOI__DEFINE_DECODE_PIXELS(qoi__decode_pixels, , qoi_rgba, 1, QOI__RGBA, QOI__PUT_PIXEL, qoi__fill_pixels)
+
+#ifndef QOI_GENERIC_ONLY
+QOI__DEFINE_DECODE_PIXELS(qoi__decode_pixels_rgb,  , uint8_t,  3, QOI__RGBA, QOI__PUT_RGB,   qoi__fill_rgb_wide)
+QOI__DEFINE_DECODE_PIXELS(qoi__decode_pixels_bgra, , qoi_rgba, 1, QOI__BGRA, QOI__PUT_PIXEL, qoi__fill_pixels)
+QOI__DEFINE_DECODE_PIXELS(qoi__decode_pixels_argb, , qoi_rgba, 1, QOI__ARGB, QOI__PUT_PIXEL, qoi__fill_pixels)
+#endif
+#endif
+
+// Advances the state over `count` pixels like qoi__decode_pixels, without storing them.
+static size_t qoi__skip_pixels(qoi_state *state, const uint8_t **data_ptr, const uint8_t *data_end, size_t count) {
+    const uint8_t *data = *data_ptr;
+    qoi_rgba prev_px = state->prev_px;
+    uint32_t run = state->run;
+    size_t left = count;
+
+    state->lookup_array[qoi_hash(&prev_px)] = prev_px;
+
+    for (;;) {
+        size_t length = left < run ? left : run;
+        run  -= length;
+        left -= length;
+        if (left == 0 || data >= data_end || (size_t)(data_end - data) < qoi__op_size(*data)) break;
+
+        if (*data == RGBA) {
+            memcpy(&prev_px, data + 1, sizeof(qoi_rgba));
+            data += 5;
+        }
+        else if (*data == RGB) {
+            prev_px.r = data[1];
+            prev_px.g = data[2];
+            prev_px.b = data[3];
+            data += 4;
+        }
+        else if ((*data & 0b11000000) == INDEX) {
+            prev_px = state->lookup_array[*data++];
+        }
+        else if ((*data & 0b11000000) == DIFF) {
+            prev_px.r += ((*data >> 4) & 0b00000011) - 2;
+            prev_px.g += ((*data >> 2) & 0b00000011) - 2;
+            prev_px.b += (*data & 0b00000011)        - 2;
+            data++;
+        }
+        else if ((*data & 0b11000000) == LUMA) {
+            int8_t dg    = (data[0] & 0b00111111)    - 32;
+            int8_t dr_dg = (data[1] >> 4 & 0b00001111) - 8;
+            int8_t db_dg = (data[1] & 0b00001111)      - 8;
+            prev_px.r += dr_dg + dg;
+            prev_px.g += dg;
+            prev_px.b += db_dg + dg;
+            data += 2;
+        }
+        else { // RUN
+            run = (*data++ & 0b00111111) + 1;
+            continue;
+        }
+
+        state->lookup_array[qoi_hash(&prev_px)] = prev_px;
+        --left;
+    }
+
+    *data_ptr = data;
+    state->prev_px = prev_px;
+    state->run = run;
+    return count - left;
+}
+
+// No op makes more than 62 pixels, so a header claiming more pixels than `ops_size` bytes of ops
+// can hold is rejected before anything is allocated for them.
+static bool qoi__check_ops_size(const qoi_header *header, size_t ops_size) {
+    if ((size_t)header->width * header->height > (uint64_t)ops_size * 62) {
+        fprintf(stderr, "[ERROR]: Image data is too short for a %ux%u image!\n", header->width, header->height);
+        return false;
+    }
+    return true;
+}
+
+// Decodes the op stream and end marker that follow the header, reading them in place.
+static bool qoi__decode_data(const uint8_t *data, size_t data_size, qoi_image *image) {
+    qoi__index index;
+    const uint8_t *data_end = qoi__data_end(data, qoi__find_index(data, data_size, QOI_END_SIZE, &index));
+    if (data_end == NULL) return false;
+    if (!qoi__check_pixel_count(image->header.width, image->header.height)) return false;
+    if (!qoi__check_ops_size(&image->header, data_end - data)) return false;
+
+    uint32_t pixel_count = image->header.width * image->header.height;
+    qoi_da_reserve(&image->image_data, pixel_count);
+
+    qoi_state state;
+    qoi__state_init(&state);
+    image->image_data.count = qoi__decode_pixels(&state, &data, data_end, image->image_data.items, pixel_count);
+
+    if (pixel_count != image->image_data.count) {
+        fprintf(stderr, "[ERROR]: Image width (%u) and heigth (%u) doesn't match parsed pixel count (%u)!\n", image->header.width, image->header.height, image->image_data.count);
+        return false;
+    }
+
+    return true;
+}
+
+static size_t qoi__layout_size(qoi_layout layout) {
+    return layout == QOI_LAYOUT_RGB ? 3 : 4;
+}
+
+static uint8_t *qoi__store_pixels(uint8_t *out, const qoi_rgba *pixels, size_t count, qoi_layout layout) {
+    const qoi_rgba *pixels_end = pixels + count;
+    switch (layout) {
+    case QOI_LAYOUT_RGBA:
+        memcpy(out, pixels, count * sizeof(qoi_rgba));
+        return out + count * sizeof(qoi_rgba);
+    case QOI_LAYOUT_RGB:
+        for (; pixels < pixels_end; ++pixels, out += 3) {
+            out[0] = pixels->r;
+            out[1] = pixels->g;
+            out[2] = pixels->b;
+        }
+        return out;
+    case QOI_LAYOUT_BGRA:
+        for (; pixels < pixels_end; ++pixels, out += 4) {
+            out[0] = pixels->b;
+            out[1] = pixels->g;
+            out[2] = pixels->r;
+            out[3] = pixels->a;
+        }
+        return out;
+    case QOI_LAYOUT_ARGB:
+        for (; pixels < pixels_end; ++pixels, out += 4) {
+            out[0] = pixels->a;
+            out[1] = pixels->r;
+            out[2] = pixels->g;
+            out[3] = pixels->b;
+        }
+        return out;
+    }
+
+    return out;
+}
+
+// 3 bytes of padding keep a 32-bit gather at any index inside the table
+static const uint8_t qoi__srgb_to_linear[256 + 3] = {
+      0,   0,   0,   0,   0,   0,   0,   1,   1,   1,   1,   1,   1,   1,   1,   1,
+      1,   1,   2,   2,   2,   2,   2,   2,   2,   2,   3,   3,   3,   3,   3,   3,
+      4,   4,   4,   4,   4,   5,   5,   5,   5,   6,   6,   6,   6,   7,   7,   7,
+      8,   8,   8,   8,   9,   9,   9,  10,  10,  10,  11,  11,  12,  12,  12,  13,
+     13,  13,  14,  14,  15,  15,  16,  16,  17,  17,  17,  18,  18,  19,  19,  20,
+     20,  21,  22,  22,  23,  23,  24,  24,  25,  25,  26,  27,  27,  28,  29,  29,
+     30,  30,  31,  32,  32,  33,  34,  35,  35,  36,  37,  37,  38,  39,  40,  41,
+     41,  42,  43,  44,  45,  45,  46,  47,  48,  49,  50,  51,  51,  52,  53,  54,
+     55,  56,  57,  58,  59,  60,  61,  62,  63,  64,  65,  66,  67,  68,  69,  70,
+     71,  72,  73,  74,  76,  77,  78,  79,  80,  81,  82,  84,  85,  86,  87,  88,
+     90,  91,  92,  93,  95,  96,  97,  99, 100, 101, 103, 104, 105, 107, 108, 109,
+    111, 112, 114, 115, 116, 118, 119, 121, 122, 124, 125, 127, 128, 130, 131, 133,
+    134, 136, 138, 139, 141, 142, 144, 146, 147, 149, 151, 152, 154, 156, 157, 159,
+    161, 163, 164, 166, 168, 170, 171, 173, 175, 177, 179, 181, 183, 184, 186, 188,
+    190, 192, 194, 196, 198, 200, 202, 204, 206, 208, 210, 212, 214, 216, 218, 220,
+    222, 224, 226, 229, 231, 233, 235, 237, 239, 242, 244, 246, 248, 250, 253, 255,
+};
+
+// The same curve unrounded, for the float decoders; qoi__srgb_to_linear rounds it to 183 levels.
+static const float qoi__srgb_to_linear_f32[256] = {
+      0.000000f,   0.077399f,   0.154799f,   0.232198f,   0.309598f,   0.386997f,   0.464396f,   0.541796f,
+      0.619195f,   0.696594f,   0.773994f,   0.853367f,   0.937509f,   1.026303f,   1.119818f,   1.218123f,
+      1.321287f,   1.429375f,   1.542452f,   1.660583f,   1.783830f,   1.912253f,   2.045914f,   2.184872f,
+      2.329185f,   2.478910f,   2.634105f,   2.794824f,   2.961123f,   3.133055f,   3.310673f,   3.494031f,
+      3.683180f,   3.878171f,   4.079055f,   4.285881f,   4.498698f,   4.717556f,   4.942502f,   5.173584f,
+      5.410848f,   5.654341f,   5.904108f,   6.160196f,   6.422649f,   6.691512f,   6.966827f,   7.248640f,
+      7.536993f,   7.831928f,   8.133488f,   8.441715f,   8.756651f,   9.078335f,   9.406810f,   9.742115f,
+     10.084290f,  10.433375f,  10.789410f,  11.152432f,  11.522482f,  11.899597f,  12.283815f,  12.675174f,
+     13.073712f,  13.479465f,  13.892470f,  14.312765f,  14.740385f,  15.175366f,  15.617744f,  16.067555f,
+     16.524833f,  16.989614f,  17.461933f,  17.941824f,  18.429322f,  18.924460f,  19.427272f,  19.937793f,
+     20.456054f,  20.982090f,  21.515934f,  22.057618f,  22.607175f,  23.164636f,  23.730036f,  24.303404f,
+     24.884774f,  25.474176f,  26.071642f,  26.677203f,  27.290891f,  27.912736f,  28.542769f,  29.181020f,
+     29.827520f,  30.482299f,  31.145387f,  31.816813f,  32.496609f,  33.184802f,  33.881422f,  34.586499f,
+     35.300062f,  36.022139f,  36.752760f,  37.491953f,  38.239746f,  38.996169f,  39.761248f,  40.535013f,
+     41.317491f,  42.108710f,  42.908697f,  43.717481f,  44.535088f,  45.361546f,  46.196882f,  47.041124f,
+     47.894297f,  48.756429f,  49.627547f,  50.507676f,  51.396845f,  52.295078f,  53.202402f,  54.118843f,
+     55.044428f,  55.979181f,  56.923129f,  57.876298f,  58.838712f,  59.810398f,  60.791381f,  61.781686f,
+     62.781338f,  63.790363f,  64.808784f,  65.836627f,  66.873918f,  67.920679f,  68.976937f,  70.042715f,
+     71.118037f,  72.202929f,  73.297414f,  74.401516f,  75.515259f,  76.638668f,  77.771765f,  78.914575f,
+     80.067122f,  81.229428f,  82.401518f,  83.583415f,  84.775142f,  85.976722f,  87.188178f,  88.409534f,
+     89.640813f,  90.882037f,  92.133229f,  93.394412f,  94.665609f,  95.946841f,  97.238133f,  98.539506f,
+     99.850982f, 101.172584f, 102.504334f, 103.846254f, 105.198366f, 106.560693f, 107.933256f, 109.316077f,
+    110.709177f, 112.112579f, 113.526305f, 114.950375f, 116.384811f, 117.829635f, 119.284868f, 120.750532f,
+    122.226647f, 123.713235f, 125.210317f, 126.717914f, 128.236047f, 129.764737f, 131.304005f, 132.853871f,
+    134.414357f, 135.985483f, 137.567270f, 139.159738f, 140.762907f, 142.376799f, 144.001434f, 145.636832f,
+    147.283012f, 148.939997f, 150.607804f, 152.286456f, 153.975971f, 155.676371f, 157.387673f, 159.109900f,
+    160.843070f, 162.587203f, 164.342319f, 166.108438f, 167.885578f, 169.673761f, 171.473005f, 173.283330f,
+    175.104755f, 176.937299f, 178.780982f, 180.635824f, 182.501843f, 184.379058f, 186.267489f, 188.167154f,
+    190.078073f, 192.000265f, 193.933749f, 195.878543f, 197.834666f, 199.802137f, 201.780975f, 203.771198f,
+    205.772826f, 207.785876f, 209.810367f, 211.846319f, 213.893748f, 215.952674f, 218.023115f, 220.105089f,
+    222.198615f, 224.303711f, 226.420395f, 228.548685f, 230.688599f, 232.840156f, 235.003373f, 237.178269f,
+    239.364861f, 241.563167f, 243.773205f, 245.994993f, 248.228549f, 250.473890f, 252.731035f, 255.000000f,
+};
+
+static void qoi__linearize_scalar(qoi_rgba *pixels, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        pixels[i].r = qoi__srgb_to_linear[pixels[i].r];
+        pixels[i].g = qoi__srgb_to_linear[pixels[i].g];
+        pixels[i].b = qoi__srgb_to_linear[pixels[i].b];
+    }
+}
+
+// Each color channel is gathered as the 32 bits at its table entry and masked to the low byte.
+#ifdef QOI__AVX2
+QOI__TARGET_AVX2 QOI__UNUSED static void qoi__linearize_avx2(qoi_rgba *pixels, size_t count) {
+    size_t i = 0;
+    const int *table = (const int *)qoi__srgb_to_linear;
+    const __m256i byte = _mm256_set1_epi32(0xFF);
+    const __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+    for (; i + 8 <= count; i += 8) {
+        __m256i px = _mm256_loadu_si256((const __m256i *)(pixels + i));
+        __m256i r = _mm256_i32gather_epi32(table, _mm256_and_si256(px, byte), 1);
+        __m256i g = _mm256_i32gather_epi32(table, _mm256_and_si256(_mm256_srli_epi32(px, 8), byte), 1);
+        __m256i b = _mm256_i32gather_epi32(table, _mm256_and_si256(_mm256_srli_epi32(px, 16), byte), 1);
+        __m256i rgb = _mm256_or_si256(_mm256_and_si256(r, byte), _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(g, byte), 8), _mm256_slli_epi32(_mm256_and_si256(b, byte), 16)));
+        _mm256_storeu_si256((__m256i *)(pixels + i), _mm256_or_si256(rgb, _mm256_and_si256(px, alpha)));
+    }
+    qoi__linearize_scalar(pixels + i, count - i);
+}
+#endif
+
+#ifdef QOI__AVX512
+QOI__TARGET_AVX512 static void qoi__linearize_avx512(qoi_rgba *pixels, size_t count) {
+    size_t i = 0;
+    const __m512i byte = _mm512_set1_epi32(0xFF);
+    const __m512i alpha = _mm512_set1_epi32((int)0xFF000000);
+    for (; i + 16 <= count; i += 16) {
+        __m512i px = _mm512_loadu_si512((const void *)(pixels + i));
+        __m512i r = _mm512_i32gather_epi32(_mm512_and_si512(px, byte), (const void *)qoi__srgb_to_linear, 1);
+        __m512i g = _mm512_i32gather_epi32(_mm512_and_si512(_mm512_srli_epi32(px, 8), byte), (const void *)qoi__srgb_to_linear, 1);
+        __m512i b = _mm512_i32gather_epi32(_mm512_and_si512(_mm512_srli_epi32(px, 16), byte), (const void *)qoi__srgb_to_linear, 1);
+        __m512i rgb = _mm512_or_si512(_mm512_and_si512(r, byte), _mm512_or_si512(_mm512_slli_epi32(_mm512_and_si512(g, byte), 8), _mm512_slli_epi32(_mm512_and_si512(b, byte), 16)));
+        _mm512_storeu_si512((void *)(pixels + i), _mm512_or_si512(rgb, _mm512_and_si512(px, alpha)));
+    }
+    qoi__linearize_avx2(pixels + i, count - i);
+}
+#endif
+
+#ifdef QOI__CPU_DISPATCH
+static void qoi__linearize(qoi_rgba *pixels, size_t count) {
+    qoi__kernels()->linearize(pixels, count);
+}
+#elif defined(__AVX512BW__)
+#define qoi__linearize qoi__linearize_avx512
+#elif defined(__AVX2__)
+#define qoi__linearize qoi__linearize_avx2
+#else
+#define qoi__linearize qoi__linearize_scalar
+#endif
+
+static void qoi__convert_pixels(qoi_rgba *pixels, size_t count, int convert) {
+    if (convert & QOI_CONVERT_LINEAR) qoi__linearize(pixels, count);
+
+    if (convert & QOI_CONVERT_PREMULTIPLY) {
+        // round(c * a / 255) is (v + (v >> 8)) >> 8 with v = c * a + 128; alpha is multiplied by 255
+        size_t i = 0;
+#ifdef QOI__SSE2
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i color_mask = _mm_setr_epi16(-1, -1, -1, 0, -1, -1, -1, 0);
+        const __m128i alpha_255 = _mm_setr_epi16(0, 0, 0, 255, 0, 0, 0, 255);
+        const __m128i half = _mm_set1_epi16(128);
+        for (; i + 4 <= count; i += 4) {
+            __m128i px = _mm_loadu_si128((const __m128i *)(pixels + i));
+            __m128i halves[2] = { _mm_unpacklo_epi8(px, zero), _mm_unpackhi_epi8(px, zero) };
+            for (int h = 0; h < 2; ++h) {
+                __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(halves[h], _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+                __m128i v = _mm_add_epi16(_mm_mullo_epi16(halves[h], _mm_or_si128(_mm_and_si128(alpha, color_mask), alpha_255)), half);
+                halves[h] = _mm_srli_epi16(_mm_add_epi16(v, _mm_srli_epi16(v, 8)), 8);
+            }
+            _mm_storeu_si128((__m128i *)(pixels + i), _mm_packus_epi16(halves[0], halves[1]));
+        }
+#endif
+        for (; i < count; ++i) {
+            uint32_t a = pixels[i].a, v;
+            v = pixels[i].r * a + 128; pixels[i].r = (v + (v >> 8)) >> 8;
+            v = pixels[i].g * a + 128; pixels[i].g = (v + (v >> 8)) >> 8;
+            v = pixels[i].b * a + 128; pixels[i].b = (v + (v >> 8)) >> 8;
+        }
+    }
+}
+
+// Decodes one row of `width` pixels into `out`. Rows are decoded in place by the core specialized
+// for the layout; conversions on other layouts go through a small stack buffer so they stay in cache.
+static bool qoi__decode_row(qoi_state *state, const uint8_t **data, const uint8_t *data_end, uint8_t *out, uint32_t width, qoi_layout layout, int convert) {
+    if (layout == QOI_LAYOUT_RGBA) {
+        if (qoi__decode_pixels(state, data, data_end, (qoi_rgba *)out, width) != width) return false;
+        qoi__convert_pixels((qoi_rgba *)out, width, convert);
+        return true;
+    }
+#ifndef QOI_GENERIC_ONLY
+    if (convert == QOI_CONVERT_NONE) {
+        switch (layout) {
+        case QOI_LAYOUT_RGBA: break;
+        case QOI_LAYOUT_RGB:  return qoi__decode_pixels_rgb(state, data, data_end, out, width) == width;
+        case QOI_LAYOUT_BGRA: return qoi__decode_pixels_bgra(state, data, data_end, (qoi_rgba *)out, width) == width;
+        case QOI_LAYOUT_ARGB: return qoi__decode_pixels_argb(state, data, data_end, (qoi_rgba *)out, width) == width;
+        }
+    }
+#endif
+
+    qoi_rgba chunk[QOI_DECODE_CHUNK];
+    for (uint32_t x = 0; x < width; x += QOI_DECODE_CHUNK) {
+        size_t count = width - x < QOI_DECODE_CHUNK ? width - x : QOI_DECODE_CHUNK;
+        if (qoi__decode_pixels(state, data, data_end, chunk, count) != count) return false;
+        qoi__convert_pixels(chunk, count, convert);
+        out = qoi__store_pixels(out, chunk, count, layout);
+    }
+
+    return true;
+}
+
+bool qoi_decode(const void *data, size_t data_size, qoi_image *image) {
+    return qoi_decode_parallel(data, data_size, image, 1);
+}
+
+typedef struct {
+    qoi_state      state;
+    const uint8_t *data;
+    const uint8_t *data_end;
+    qoi_rgba      *pixels;
+    size_t         count;
+    bool           result;
+} qoi__band;
+
+static void qoi__band_decode(void *item) {
+    qoi__band *band = item;
+    band->result = qoi__decode_pixels(&band->state, &band->data, band->data_end, band->pixels, band->count) == band->count;
+}
+
+// Decodes the row bands between the checkpoints of a seek index concurrently.
+static bool qoi__decode_bands(const uint8_t *data, const uint8_t *data_end, const qoi__index *index, qoi_image *image, uint32_t thread_count) {
+    uint32_t width = image->header.width, height = image->header.height;
+    uint32_t band_count = index->count + 1;
+    if (index->rows == 0 || (uint64_t)index->count * index->rows >= height || (uint64_t)band_count * index->rows < height) {
+        fprintf(stderr, "[ERROR]: Seek index doesn't match image height (%u)!\n", height);
+        return false;
+    }
+
+    qoi__band *bands = QOI_Malloc(band_count * sizeof(qoi__band));
+    if (bands == NULL) {
+        fprintf(stderr, "[ERROR]: Couldn't allocate bands!\n");
+        return false;
+    }
+
+    bool result = true;
+    for (uint32_t i = 0; i < band_count; ++i) {
+        uint32_t row = i * index->rows;
+        uint32_t rows = height - row < index->rows ? height - row : index->rows;
+        bands[i].data_end = data_end;
+        bands[i].pixels   = image->image_data.items + (size_t)row * width;
+        bands[i].count    = (size_t)rows * width;
+
+        if (i == 0) {
+            qoi__state_init(&bands[i].state);
+            bands[i].data = data + QOI_HEADER_SIZE;
+        }
+        else if (!qoi__resume_checkpoint(index->checkpoints + (i - 1) * QOI_CHECKPOINT_SIZE, data, data_end, &bands[i].state, &bands[i].data)) {
+            fprintf(stderr, "[ERROR]: Incorrect checkpoint at row %u!\n", row);
+            result = false;
+            goto defer;
+        }
+    }
+
+    qoi__parallel_for(qoi__band_decode, bands, sizeof(qoi__band), band_count, thread_count);
+
+    for (uint32_t i = 0; i < band_count; ++i) {
+        if (!bands[i].result) {
+            fprintf(stderr, "[ERROR]: Image data ended in row band %u!\n", i);
+            result = false;
+        }
+    }
+
+defer:
+    QOI_Free(bands);
+    return result;
+}
+
+bool qoi_decode_parallel(const void *data, size_t data_size, qoi_image *image, uint32_t thread_count) {
+    return qoi_decode_limited(data, data_size, image, QOI_PIXELS_MAX, thread_count);
+}
+
+bool qoi_decode_limited(const void *data, size_t data_size, qoi_image *image, uint32_t max_pixels, uint32_t thread_count) {
+    if (!qoi_decode_header(data, data_size, &image->header)) {
+        fprintf(stderr, "[ERROR]: Incorrect header data!\n");
+        return false;
+    }
+    if (!qoi__check_pixel_count(image->header.width, image->header.height)) return false;
+    if ((size_t)image->header.width * image->header.height > max_pixels) {
+        fprintf(stderr, "[ERROR]: Image size (%ux%u) exceeds the limit of %u pixels!\n", image->header.width, image->header.height, max_pixels);
+        return false;
+    }
+
+    if (thread_count == 0) thread_count = qoi_cpu_count();
+
+    qoi__index index;
+    size_t stream_size = qoi__find_index(data, data_size, QOI_HEADER_SIZE + QOI_END_SIZE, &index);
+    if (stream_size >= QOI_HEADER_SIZE + QOI_END_SIZE && !qoi__check_ops_size(&image->header, stream_size - QOI_HEADER_SIZE - QOI_END_SIZE)) {
+        return false;
+    }
+    if (thread_count == 1 || index.count == 0) {
+        // qoi__decode_data splits the seek index off itself; handing it the stream without the index
+        // would split off a second one and accept files qoi_validate rejects
+        if (!qoi__decode_data((const uint8_t *)data + QOI_HEADER_SIZE, data_size - QOI_HEADER_SIZE, image)) {
+            fprintf(stderr, "[ERROR]: Incorrect image data!\n");
+            return false;
+        }
+        return true;
+    }
+
+    const uint8_t *data_end = qoi__data_end((const uint8_t *)data + QOI_HEADER_SIZE, stream_size - QOI_HEADER_SIZE);
+    if (data_end == NULL) return false;
+
+    uint32_t pixel_count = image->header.width * image->header.height;
+    qoi_da_reserve(&image->image_data, pixel_count);
+    if (!qoi__decode_bands(data, data_end, &index, image, thread_count)) {
+        fprintf(stderr, "[ERROR]: Incorrect image data!\n");
+        return false;
+    }
+    image->image_data.count = pixel_count;
+
+    return true;
+}
+
+// Reads until EOF, so it works on pipes and other unseekable streams.
+static bool qoi__read_all(FILE *fd, qoi_bytes *bytes) {
+    for (;;) {
+        if (bytes->count + QOI_READ_CHUNK > bytes->capacity) {
+            qoi_da_reserve(bytes, bytes->capacity == 0 ? QOI_READ_CHUNK : bytes->capacity * 2);
+        }
+        size_t read_count = fread(bytes->items + bytes->count, 1, bytes->capacity - bytes->count, fd);
+        bytes->count += read_count;
+        if (read_count == 0) break;
+    }
+    if (ferror(fd)) {
+        fprintf(stderr, "[ERROR]: Couldn't read data!\n");
+        return false;
+    }
+
+    return true;
+}
+
+void qoi_decoder_init(qoi_decoder *decoder, qoi_row_func on_row, void *user) {
+    memset(decoder, 0, sizeof(*decoder));
+    qoi__state_init(&decoder->state);
+    decoder->on_row     = on_row;
+    decoder->user       = user;
+    decoder->max_pixels = QOI_PIXELS_MAX;
+}
+
+void qoi_decoder_free(qoi_decoder *decoder) {
+    QOI_Free(decoder->pixels);
+    decoder->pixels = NULL;
+}
+
+// Decodes the complete ops in [*data, data_end) into rows until either runs out.
+static bool qoi__decoder_emit(qoi_decoder *decoder, const uint8_t **data, const uint8_t *data_end) {
+    uint32_t width = decoder->header.width;
+    for (;;) {
+        decoder->x += qoi__decode_pixels(&decoder->state, data, data_end, decoder->pixels + decoder->x, width - decoder->x);
+        if (decoder->x < width) return true;
+
+        if (!decoder->on_row(decoder->user, decoder->row, decoder->pixels, width)) return false;
+        decoder->x = 0;
+        if (++decoder->row == decoder->header.height) {
+            decoder->phase = QOI_DECODER_END;
+            return true;
+        }
+    }
+}
+
+static bool qoi__decoder_match_end(qoi_decoder *decoder, const uint8_t *data, const uint8_t *data_end) {
+    for (; decoder->phase == QOI_DECODER_END && data < data_end; ++data) {
+        if (*data != QOI_END[decoder->pending_count]) {
+            fprintf(stderr, "[ERROR]: Incorrect end magic!\n");
+            return false;
+        }
+        if (++decoder->pending_count == QOI_END_SIZE) decoder->phase = QOI_DECODER_DONE;
+    }
+
+    return true;
+}
+
+bool qoi_decoder_push(qoi_decoder *decoder, const void *data, size_t data_size) {
+    const uint8_t *p = data;
+    const uint8_t *end = p + data_size;
+
+    if (decoder->phase == QOI_DECODER_HEADER) {
+        while (decoder->pending_count < QOI_HEADER_SIZE && p < end) {
+            decoder->pending[decoder->pending_count++] = *p++;
+        }
+        if (decoder->pending_count < QOI_HEADER_SIZE) return true;
+
+        decoder->pending_count = 0;
+        if (!qoi_decode_header(decoder->pending, QOI_HEADER_SIZE, &decoder->header)) return false;
+        if ((size_t)decoder->header.width * decoder->header.height > decoder->max_pixels) {
+            fprintf(stderr, "[ERROR]: Image size (%ux%u) exceeds the limit of %u pixels!\n", decoder->header.width, decoder->header.height, decoder->max_pixels);
+            return false;
+        }
+
+        // an empty image has no rows to hand over, however many its header claims, and needs no row buffer
+        if (decoder->header.width == 0 || decoder->header.height == 0) {
+            decoder->phase = QOI_DECODER_END;
+        }
+        else {
+            decoder->pixels = QOI_Malloc((size_t)decoder->header.width * sizeof(qoi_rgba));
+            if (decoder->pixels == NULL) {
+                fprintf(stderr, "[ERROR]: Couldn't allocate row of %u pixels!\n", decoder->header.width);
+                return false;
+            }
+            decoder->phase = QOI_DECODER_DATA;
+        }
+    }
+
+    if (decoder->phase == QOI_DECODER_DATA && decoder->pending_count > 0) {
+        // complete the op split by the previous chunk
+        size_t op_size = qoi__op_size(decoder->pending[0]);
+        while (decoder->pending_count < op_size && p < end) {
+            decoder->pending[decoder->pending_count++] = *p++;
+        }
+        if (decoder->pending_count < op_size) return true;
+
+        const uint8_t *op = decoder->pending;
+        if (!qoi__decoder_emit(decoder, &op, op + op_size)) return false;
+
+        size_t left = decoder->pending + decoder->pending_count - op;
+        decoder->pending_count = 0;
+        if (!qoi__decoder_match_end(decoder, op, op + left)) return false;
+    }
+
+    if (decoder->phase == QOI_DECODER_DATA) {
+        if (!qoi__decoder_emit(decoder, &p, end)) return false;
+    }
+
+    if (decoder->phase == QOI_DECODER_DATA) {
+        // only an op split by the end of the chunk is left
+        memcpy(decoder->pending, p, end - p);
+        decoder->pending_count = end - p;
+        return true;
+    }
+
+    // anything after the end marker (like a seek index) is ignored
+    return qoi__decoder_match_end(decoder, p, end);
+}
+
+bool qoi_decoder_finish(qoi_decoder *decoder) {
+    if (decoder->phase != QOI_DECODER_DONE) {
+        fprintf(stderr, "[ERROR]: Image data ended at row %u of %u!\n", decoder->row, decoder->header.height);
+        return false;
+    }
+
+    return true;
+}
+
+// Finds the op stream of a whole file whose header is already checked, without its end marker and seek index.
+static bool qoi__find_ops(const void *data, size_t data_size, const uint8_t **ops, const uint8_t **ops_end) {
+    qoi__index index;
+    *ops = (const uint8_t *)data + QOI_HEADER_SIZE;
+    *ops_end = qoi__data_end(*ops, qoi__find_index(data, data_size, QOI_HEADER_SIZE + QOI_END_SIZE, &index) - QOI_HEADER_SIZE);
+    return *ops_end != NULL;
+}
+
+// Decodes the rectangle at (x, y) of an image whose header is already checked. Rows above it are
+// skipped from the closest checkpoint of a seek index, and decoding stops after its last row.
+static bool qoi__decode_rect(const void *data, size_t data_size, const qoi_header *header, uint32_t x, uint32_t y, uint32_t width, uint32_t height, void *pixels, size_t pixels_size, size_t stride, qoi_layout layout, int convert) {
+    size_t row_size = width * qoi__layout_size(layout);
+    if (stride == 0) stride = row_size;
+    if (stride < row_size) {
+        fprintf(stderr, "[ERROR]: Stride (%zu) is smaller than the row size (%zu)!\n", stride, row_size);
+        return false;
+    }
+    if (height > 0 && pixels_size < stride * (height - 1) + row_size) {
+        fprintf(stderr, "[ERROR]: Pixel buffer (%zu bytes) is too small for a %ux%u image!\n", pixels_size, width, height);
+        return false;
+    }
+
+    qoi__index index;
+    const uint8_t *ops, *ops_end;
+    if (!qoi__find_ops(data, data_size, &ops, &ops_end)) return false;
+    if (width == 0 || height == 0) return true; // however many empty rows the header claims
+    qoi__find_index(data, data_size, QOI_HEADER_SIZE + QOI_END_SIZE, &index);
+
+    qoi_state state;
+    qoi__state_init(&state);
+
+    uint32_t row = 0;
+    if (index.count > 0 && index.rows > 0 && y >= index.rows) {
+        uint32_t checkpoint = y / index.rows < index.count ? y / index.rows : index.count;
+        if (!qoi__resume_checkpoint(index.checkpoints + (checkpoint - 1) * QOI_CHECKPOINT_SIZE, data, ops_end, &state, &ops)) {
+            fprintf(stderr, "[ERROR]: Incorrect checkpoint at row %u!\n", checkpoint * index.rows);
+            return false;
+        }
+        row = checkpoint * index.rows;
+    }
+
+    size_t skip = (size_t)(y - row) * header->width + x;
+    if (qoi__skip_pixels(&state, &ops, ops_end, skip) != skip) {
+        fprintf(stderr, "[ERROR]: Image data ended before row %u!\n", y);
+        return false;
+    }
+
+    uint8_t *out = pixels;
+    for (uint32_t j = 0; j < height; ++j, out += stride) {
+        if (!qoi__decode_row(&state, &ops, ops_end, out, width, layout, convert)) {
+            fprintf(stderr, "[ERROR]: Image data ended at row %u of %u!\n", y + j, header->height);
+            return false;
+        }
+
+        // the columns right of this row and left of the next one
+        skip = j + 1 < height ? header->width - width : 0;
+        if (qoi__skip_pixels(&state, &ops, ops_end, skip) != skip) {
+            fprintf(stderr, "[ERROR]: Image data ended at row %u of %u!\n", y + j, header->height);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool qoi_decode_into(const void *data, size_t data_size, qoi_header *header, void *pixels, size_t pixels_size, size_t stride, qoi_layout layout) {
+    if (!qoi_decode_header(data, data_size, header)) {
+        fprintf(stderr, "[ERROR]: Incorrect header data!\n");
+        return false;
+    }
+
+    return qoi__decode_rect(data, data_size, header, 0, 0, header->width, header->height, pixels, pixels_size, stride, layout, QOI_CONVERT_NONE);
+}
+
+// Like qoi_decode_into, with the qoi_convert flags in `convert` applied to every row as it's decoded.
+// Linearizing to 8 bits merges the 256 sRGB levels into 183; qoi_decode_planar_f32_converted keeps them apart.
+bool qoi_decode_into_converted(const void *data, size_t data_size, qoi_header *header, void *pixels, size_t pixels_size, size_t stride, qoi_layout layout, int convert) {
+    if (!qoi_decode_header(data, data_size, header)) {
+        fprintf(stderr, "[ERROR]: Incorrect header data!\n");
+        return false;
+    }
+    if (header->colorspace == 1) convert &= ~QOI_CONVERT_LINEAR; // all channels are linear already
+
+    return qoi__decode_rect(data, data_size, header, 0, 0, header->width, header->height, pixels, pixels_size, stride, layout, convert);
+}
+
+static bool qoi__check_region(const qoi_header *header, uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+    if ((uint64_t)x + width > header->width || (uint64_t)y + height > header->height) {
+        fprintf(stderr, "[ERROR]: Region %ux%u at (%u, %u) is outside of the %ux%u image!\n", width, height, x, y, header->width, header->height);
+        return false;
+    }
+
+    return true;
+}
+
+bool qoi_decode_region_into(const void *data, size_t data_size, qoi_header *header, uint32_t x, uint32_t y, uint32_t width, uint32_t height, void *pixels, size_t pixels_size, size_t stride, qoi_layout layout) {
+    if (!qoi_decode_header(data, data_size, header)) {
+        fprintf(stderr, "[ERROR]: Incorrect header data!\n");
+        return false;
+    }
+    if (!qoi__check_region(header, x, y, width, height)) return false;
+
+    return qoi__decode_rect(data, data_size, header, x, y, width, height, pixels, pixels_size, stride, layout, QOI_CONVERT_NONE);
+}
+
+// Decodes only the given rectangle; `region` gets its size in the header and only its pixels.
+bool qoi_decode_region(const void *data, size_t data_size, uint32_t x, uint32_t y, uint32_t width, uint32_t height, qoi_image *region) {
+    if (!qoi_decode_header(data, data_size, &region->header)) {
+        fprintf(stderr, "[ERROR]: Incorrect header data!\n");
+        return false;
+    }
+    if (!qoi__check_region(&region->header, x, y, width, height)) return false;
+    if (!qoi__check_pixel_count(width, height)) return false;
+
+    size_t pixel_count = (size_t)width * height;
+    qoi_da_reserve(&region->image_data, pixel_count + 1); // non-empty for empty regions
+    if (!qoi_decode_region_into(data, data_size, &region->header, x, y, width, height, region->image_data.items, pixel_count * sizeof(qoi_rgba), 0, QOI_LAYOUT_RGBA)) {
+        return false;
+    }
+
+    region->header.width  = width;
+    region->header.height = height;
+    region->image_data.count = pixel_count;
+    return true;
+}
+
+// Decodes straight into a `factor` times smaller image: every output pixel is the rounded mean of
+// its factor x factor box (smaller at the right and bottom edges). Only one row of box sums is kept.
+bool qoi_decode_downscaled(const void *data, size_t data_size, uint32_t factor, qoi_image *thumb) {
+    if (!qoi_decode_header(data, data_size, &thumb->header)) {
+        fprintf(stderr, "[ERROR]: Incorrect header data!\n");
+        return false;
+    }
+    if (factor == 0 || factor > QOI_DOWNSCALE_MAX) {
+        fprintf(stderr, "[ERROR]: Downscale factor (%u) must be between 1 and %u!\n", factor, QOI_DOWNSCALE_MAX);
+        return false;
+    }
+
+    const uint8_t *ops, *ops_end;
+    if (!qoi__find_ops(data, data_size, &ops, &ops_end)) return false;
+    if (!qoi__check_ops_size(&thumb->header, ops_end - ops)) return false;
+
+    // only the thumbnail is allocated, so the source may be larger than QOI_PIXELS_MAX
+    uint32_t width = thumb->header.width, height = thumb->header.height;
+    uint32_t out_width = (uint32_t)(((uint64_t)width + factor - 1) / factor), out_height = (uint32_t)(((uint64_t)height + factor - 1) / factor);
+    if (!qoi__check_pixel_count(out_width, out_height)) return false;
+    qoi_da_reserve(&thumb->image_data, (size_t)out_width * out_height + 1); // non-empty for empty images
+    if (width == 0 || height == 0) {
+        // nothing to sum up, however many empty rows or columns the header claims
+        thumb->header.width  = out_width;
+        thumb->header.height = out_height;
+        thumb->image_data.count = 0;
+        return true;
+    }
+
+    uint32_t *sums = QOI_Calloc((size_t)out_width * 4 + 1, sizeof(uint32_t));
+    if (sums == NULL) {
+        fprintf(stderr, "[ERROR]: Couldn't allocate row of %u box sums!\n", out_width);
+        return false;
+    }
+
+    bool result = true;
+    qoi_state state;
+    qoi__state_init(&state);
+
+    qoi_rgba chunk[QOI_DECODE_CHUNK];
+    qoi_rgba *out = thumb->image_data.items;
+    for (uint32_t y = 0; y < height; ++y) {
+        uint32_t *sum = sums, box_x = 0;
+        for (uint32_t x = 0; x < width; x += QOI_DECODE_CHUNK) {
+            size_t count = width - x < QOI_DECODE_CHUNK ? width - x : QOI_DECODE_CHUNK;
+            if (qoi__decode_pixels(&state, &ops, ops_end, chunk, count) != count) {
+                fprintf(stderr, "[ERROR]: Image data ended at row %u of %u!\n", y, height);
+                result = false;
+                goto defer;
+            }
+
+            for (size_t i = 0; i < count; ++i) {
+                sum[0] += chunk[i].r;
+                sum[1] += chunk[i].g;
+                sum[2] += chunk[i].b;
+                sum[3] += chunk[i].a;
+                if (++box_x == factor) {
+                    box_x = 0;
+                    sum += 4;
+                }
+            }
+        }
+
+        uint32_t box_y = y % factor + 1;
+        if (box_y < factor && y + 1 < height) continue;
+
+        for (uint32_t c = 0; c < out_width; ++c, ++out) {
+            uint32_t box_width = width - c * factor < factor ? width - c * factor : factor;
+            uint32_t n = box_width * box_y;
+            uint32_t *s = sums + (size_t)c * 4;
+            out->r = (s[0] + n / 2) / n;
+            out->g = (s[1] + n / 2) / n;
+            out->b = (s[2] + n / 2) / n;
+            out->a = (s[3] + n / 2) / n;
+        }
+        memset(sums, 0, (size_t)out_width * 4 * sizeof(uint32_t));
+    }
+
+    thumb->header.width  = out_width;
+    thumb->header.height = out_height;
+    thumb->image_data.count = (size_t)out_width * out_height;
+
+defer:
+    QOI_Free(sums);
+    return result;
+}
+
+// Decodes into one plane per channel (R, G, B, A), element type given by `f32`. Pixels go through a
+// small stack chunk and are scattered while it is still in cache; NULL planes are skipped.
+// Float planes apply the qoi_convert flags in `convert` without rounding to 8 bits.
+static bool qoi__decode_planes(const void *data, size_t data_size, qoi_header *header, void *const planes[4], size_t plane_size, bool f32, const float scale[4], const float bias[4], int convert) {
+    if (!qoi_decode_header(data, data_size, header)) {
+        fprintf(stderr, "[ERROR]: Incorrect header data!\n");
+        return false;
+    }
+    if (header->colorspace == 1) convert &= ~QOI_CONVERT_LINEAR; // all channels are linear already
+
+    size_t pixel_count = (size_t)header->width * header->height;
+    if (plane_size < pixel_count) {
+        fprintf(stderr, "[ERROR]: Planes (%zu elements) are too small for a %ux%u image!\n", plane_size, header->width, header->height);
+        return false;
+    }
+
+    const uint8_t *ops, *ops_end;
+    if (!qoi__find_ops(data, data_size, &ops, &ops_end)) return false;
+
+    qoi_state state;
+    qoi__state_init(&state);
+
+    float channel_scale[4], channel_bias[4];
+    for (int c = 0; c < 4; ++c) {
+        channel_scale[c] = scale != NULL ? scale[c] : 1.0f;
+        channel_bias[c]  = bias != NULL ? bias[c] : 0.0f;
+    }
+
+    qoi_rgba chunk[QOI_DECODE_CHUNK];
+    for (size_t offset = 0; offset < pixel_count; offset += QOI_DECODE_CHUNK) {
+        size_t count = pixel_count - offset < QOI_DECODE_CHUNK ? pixel_count - offset : QOI_DECODE_CHUNK;
+        if (qoi__decode_pixels(&state, &ops, ops_end, chunk, count) != count) {
+            fprintf(stderr, "[ERROR]: Image data ended at row %zu of %u!\n", offset / header->width, header->height);
+            return false;
+        }
+
+        for (int c = 0; c < 4; ++c) {
+            if (planes[c] == NULL) continue;
+            const uint8_t *channel = (const uint8_t *)chunk + c;
+            if (f32 && c < 3 && convert != QOI_CONVERT_NONE) {
+                float *plane = (float *)planes[c] + offset;
+                bool linear = convert & QOI_CONVERT_LINEAR, premultiply = convert & QOI_CONVERT_PREMULTIPLY;
+                for (size_t i = 0; i < count; ++i) {
+                    float value = linear ? qoi__srgb_to_linear_f32[channel[i*4]] : channel[i*4];
+                    if (premultiply) value *= chunk[i].a * (1.0f / 255.0f);
+                    plane[i] = value * channel_scale[c] + channel_bias[c];
+                }
+            }
+            else if (f32) {
+                float *plane = (float *)planes[c] + offset;
+                for (size_t i = 0; i < count; ++i) plane[i] = channel[i*4] * channel_scale[c] + channel_bias[c];
+            }
+            else {
+                uint8_t *plane = (uint8_t *)planes[c] + offset;
+                for (size_t i = 0; i < count; ++i) plane[i] = channel[i*4];
+            }
+        }
+    }
+
+    return true;
+}
+
+bool qoi_decode_planar(const void *data, size_t data_size, qoi_header *header, uint8_t *const planes[4], size_t plane_size) {
+    void *const untyped[4] = { planes[0], planes[1], planes[2], planes[3] };
+    return qoi__decode_planes(data, data_size, header, untyped, plane_size, false, NULL, NULL, QOI_CONVERT_NONE);
+}
+
+// Every sample is stored as `value * scale[c] + bias[c]`; NULL scale and bias mean 1 and 0.
+bool qoi_decode_planar_f32(const void *data, size_t data_size, qoi_header *header, float *const planes[4], size_t plane_size, const float scale[4], const float bias[4]) {
+    void *const untyped[4] = { planes[0], planes[1], planes[2], planes[3] };
+    return qoi__decode_planes(data, data_size, header, untyped, plane_size, true, scale, bias, QOI_CONVERT_NONE);
+}
+
+// Like qoi_decode_planar_f32, with the qoi_convert flags in `convert` applied before scale and bias.
+// Linearized samples keep the full curve (0 to 255, unrounded) rather than the 8-bit table's 183 levels.
+bool qoi_decode_planar_f32_converted(const void *data, size_t data_size, qoi_header *header, float *const planes[4], size_t plane_size, const float scale[4], const float bias[4], int convert) {
+    void *const untyped[4] = { planes[0], planes[1], planes[2], planes[3] };
+    return qoi__decode_planes(data, data_size, header, untyped, plane_size, true, scale, bias, convert);
+}
+
+bool qoi_validate(const void *data, size_t data_size, qoi_header *header) {
+    const uint8_t *ops, *ops_end;
+    if (!qoi_decode_header(data, data_size, header) || !qoi__find_ops(data, data_size, &ops, &ops_end)) return false;
+
+    // only the op sizes and run lengths matter, so nothing is decoded
+    uint64_t pixel_count = (uint64_t)header->width * header->height, count = 0;
+    while (ops < ops_end) {
+        size_t op_size = qoi__op_size(*ops);
+        if ((size_t)(ops_end - ops) < op_size) {
+            fprintf(stderr, "[ERROR]: Op at byte %zu runs past the end marker!\n", (size_t)(ops - (const uint8_t *)data));
+            return false;
+        }
+        count += (*ops & 0b11000000) == RUN && *ops < RGB ? (*ops & 0b00111111) + 1 : 1;
+        ops += op_size;
+    }
+
+    if (count != pixel_count) {
+        fprintf(stderr, "[ERROR]: Image data holds %llu pixels instead of %ux%u!\n", (unsigned long long)count, header->width, header->height);
+        return false;
+    }
+
+    return true;
+}
+
+// Like qoi_validate, but also decodes the pixels through a small stack buffer and returns
+// the 64-bit FNV-1a hash of their RGBA bytes.
+bool qoi_validate_hash(const void *data, size_t data_size, qoi_header *header, uint64_t *hash) {
+    const uint8_t *ops, *ops_end;
+    if (!qoi_decode_header(data, data_size, header) || !qoi__find_ops(data, data_size, &ops, &ops_end)) return false;
+
+    qoi_state state;
+    qoi__state_init(&state);
+
+    qoi_rgba chunk[QOI_DECODE_CHUNK];
+    uint64_t pixel_count = (uint64_t)header->width * header->height;
+    *hash = 0xCBF29CE484222325ULL;
+    for (uint64_t x = 0; x < pixel_count;) {
+        size_t count = pixel_count - x < QOI_DECODE_CHUNK ? pixel_count - x : QOI_DECODE_CHUNK;
+        size_t decoded = qoi__decode_pixels(&state, &ops, ops_end, chunk, count);
+        for (const uint8_t *p = (const uint8_t *)chunk, *end = (const uint8_t *)(chunk + decoded); p < end; ++p) {
+            *hash = (*hash ^ *p) * 0x100000001B3ULL;
+        }
+
+        x += decoded;
+        if (decoded < count) {
+            fprintf(stderr, "[ERROR]: Image data holds %llu pixels instead of %ux%u!\n", (unsigned long long)x, header->width, header->height);
+            return false;
+        }
+    }
+
+    if (ops < ops_end || state.run > 0) {
+        fprintf(stderr, "[ERROR]: Image data holds more than %ux%u pixels!\n", header->width, header->height);
+        return false;
+    }
+
+    return true;
+}
+
+bool qoi_load_image_data(FILE *fd, qoi_image* image) {
+    qoi_bytes data = {0};
+    bool result = qoi__read_all(fd, &data) && qoi__decode_data(data.items, data.count, image);
+    qoi_free_bytes(&data);
+    return result;
+}
+
+static bool qoi__load_image_buffered(FILE *fd, qoi_image *image) {
+    qoi_bytes data = {0};
+    bool result = qoi__read_all(fd, &data) && qoi_decode_parallel(data.items, data.count, image, 0);
+    qoi_free_bytes(&data);
+    return result;
+}
+
+#ifndef _WIN32
+bool qoi_load_image(const char* filepath, qoi_image* image) {
+    int fd = open(filepath, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "[ERROR]: Couldn't open file %s!\n", filepath);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            close(fd);
+#ifdef MADV_SEQUENTIAL
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+#endif
+            bool result = qoi_decode_parallel(data, st.st_size, image, 0);
+            munmap(data, st.st_size);
+            return result;
+        }
+    }
+
+    // pipes, character devices and filesystems without mmap support
+    FILE *file = fdopen(fd, "rb");
+    if (NULL == file) {
+        fprintf(stderr, "[ERROR]: Couldn't open file %s!\n", filepath);
+        close(fd);
+        return false;
+    }
+
+    bool result = qoi__load_image_buffered(file, image);
+    fclose(file);
+    return result;
+}
+
+// Reads exactly the header from the current position of `fd`.
+bool qoi_probe_fd(int fd, qoi_header *header) {
+    uint8_t bytes[QOI_HEADER_SIZE];
+    size_t count = 0;
+    while (count < QOI_HEADER_SIZE) {
+        ssize_t read_count = read(fd, bytes + count, QOI_HEADER_SIZE - count);
+        if (read_count < 0 && errno == EINTR) continue;
+        if (read_count <= 0) {
+            fprintf(stderr, "[ERROR]: Couldn't read image header!\n");
+            return false;
+        }
+        count += read_count;
+    }
+
+    return qoi_decode_header(bytes, QOI_HEADER_SIZE, header);
+}
+
+// Reads only the header; `file_size` (optional) gets the size of the whole file.
+bool qoi_probe_file(const char *filepath, qoi_header *header, uint64_t *file_size) {
+    int fd = open(filepath, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "[ERROR]: Couldn't open file %s!\n", filepath);
+        return false;
+    }
+
+    struct stat st;
+    bool result = true;
+    if (file_size != NULL) {
+        result = fstat(fd, &st) == 0;
+        *file_size = result ? (uint64_t)st.st_size : 0;
+    }
+    result = result && qoi_probe_fd(fd, header);
+    close(fd);
+    return result;
+}
+#else
+bool qoi_load_image(const char* filepath, qoi_image* image) {
+    FILE *fd = fopen(filepath, "rb");
+    if (NULL == fd) {
+        fprintf(stderr, "[ERROR]: Couldn't open file %s!\n", filepath);
+        return false;
+    }
+
+    bool result = qoi__load_image_buffered(fd, image);
+    fclose(fd);
+    return result;
+}
+
+bool qoi_probe_fd(int fd, qoi_header *header) {
+    uint8_t bytes[QOI_HEADER_SIZE];
+    int count = 0;
+    while (count < QOI_HEADER_SIZE) {
+        int read_count = _read(fd, bytes + count, QOI_HEADER_SIZE - count);
+        if (read_count <= 0) {
+            fprintf(stderr, "[ERROR]: Couldn't read image header!\n");
+            return false;
+        }
+        count += read_count;
+    }
+
+    return qoi_decode_header(bytes, QOI_HEADER_SIZE, header);
+}
+
+bool qoi_probe_file(const char *filepath, qoi_header *header, uint64_t *file_size) {
+    int fd = _open(filepath, _O_RDONLY | _O_BINARY);
+    if (fd < 0) {
+        fprintf(stderr, "[ERROR]: Couldn't open file %s!\n", filepath);
+        return false;
+    }
+
+    struct _stat64 st;
+    bool result = true;
+    if (file_size != NULL) {
+        result = _fstat64(fd, &st) == 0;
+        *file_size = result ? (uint64_t)st.st_size : 0;
+    }
+    result = result && qoi_probe_fd(fd, header);
+    _close(fd);
+    return result;
+}
+#endif
+
+void qoi_free_image(qoi_image* image) {
+    QOI_Free(image->image_data.items);
+}
+
+// Worst case is an RGBA op (5 bytes) per pixel, or an RGB op (4 bytes) when every pixel is opaque.
+static size_t qoi__encoded_size_bound(size_t pixel_count, bool opaque) {
+    return QOI_HEADER_SIZE + pixel_count * (opaque ? 4 : 5) + QOI_END_SIZE;
+}
+
+// `channels` only goes to the header: qoi_encode writes an RGBA op for every alpha change whatever
+// it says, so the bound is 5 bytes per pixel for 3 channels too. Returns 0 for oversized images.
+size_t qoi_max_encoded_size(uint32_t width, uint32_t height, uint8_t channels) {
+    (void)channels;
+    size_t pixel_count = (size_t)width * height;
+    if (pixel_count > QOI_PIXELS_MAX) return 0;
+    return qoi__encoded_size_bound(pixel_count, false);
+}
+
+static uint8_t *qoi__encode_header(uint8_t *out, uint32_t width, uint32_t height, uint8_t channels, uint8_t colorspace) {
+    memcpy(out, QOI_MAGIC, 4);
+    qoi__write_u32be(out + 4, width);
+    qoi__write_u32be(out + 8, height);
+    out[12] = channels;
+    out[13] = colorspace;
+    return out + QOI_HEADER_SIZE;
+}
+
+// Encodes `count` pixels continuing from `state`. A trailing run is kept pending in `state->run`,
+// so consecutive calls produce the same bytes as one call over all pixels.
+// Returns NULL if `out_end` would be overrun.
+#ifdef QOI__SSE2
+#define QOI__BLOCK_PIXELS 16
+
+// Per-pixel facts about a block, each relative to the pixel before it.
+typedef struct {
+    uint32_t run;   // bit i: equal to the previous pixel
+    uint32_t alpha; // bit i: alpha changed
+    uint32_t diff;  // bit i: fits DIFF
+    uint32_t luma;  // bit i: fits LUMA
+    uint8_t hash[QOI__BLOCK_PIXELS];
+    uint32_t diff_op[QOI__BLOCK_PIXELS]; // DIFF byte
+    uint32_t luma_op[QOI__BLOCK_PIXELS]; // both LUMA bytes, first one low
+} qoi__block;
+
+// With `opaque` every alpha is known to be 255 and the alpha bits are left clear.
+static QOI__ALWAYS_INLINE void qoi__classify_block(const qoi_rgba *pixels, qoi_rgba prev_px, qoi__block *block, bool opaque) {
+    qoi_rgba px[QOI__BLOCK_PIXELS + 1];
+    px[0] = prev_px;
+    memcpy(px + 1, pixels, QOI__BLOCK_PIXELS * sizeof(qoi_rgba));
+
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i hash_weights = _mm_setr_epi16(3, 5, 7, 11, 3, 5, 7, 11);
+    const __m128i diff_bias = _mm_set1_epi32(0x00020202);
+    const __m128i diff_mask = _mm_set1_epi32((int)0xFFFCFCFC);
+    const __m128i luma_bias = _mm_set1_epi32(0x00082008);
+    const __m128i luma_mask = _mm_set1_epi32((int)0xFFF0C0F0);
+    const __m128i alpha_mask = _mm_set1_epi32((int)0xFF000000);
+    __m128i hashes[4];
+
+    block->run = block->alpha = block->diff = block->luma = 0;
+    for (int i = 0; i < 4; ++i) {
+        __m128i cur = _mm_loadu_si128((const __m128i *)(px + 1 + 4*i));
+        __m128i prev = _mm_loadu_si128((const __m128i *)(px + 4*i));
+        __m128i d = _mm_sub_epi8(cur, prev);
+        __m128i g = _mm_and_si128(_mm_srli_epi32(d, 8), _mm_set1_epi32(0xFF));
+        __m128i l = _mm_add_epi8(_mm_sub_epi8(d, _mm_or_si128(g, _mm_slli_epi32(g, 16))), luma_bias); // dr-dg, dg, db-dg, da
+        __m128i f = _mm_add_epi8(d, diff_bias);
+
+        block->run |= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(d, zero))) << 4*i;
+        if (!opaque) block->alpha |= (~_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(d, alpha_mask), zero))) & 0xF) << 4*i;
+        block->diff |= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(f, diff_mask), zero))) << 4*i;
+        block->luma |= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(l, luma_mask), zero))) << 4*i;
+
+        __m128i diff_op = _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_slli_epi32(f, 4), _mm_set1_epi32(0x30)),
+                                                    _mm_and_si128(_mm_srli_epi32(f, 6), _mm_set1_epi32(0x0C))),
+                                       _mm_or_si128(_mm_and_si128(_mm_srli_epi32(f, 16), _mm_set1_epi32(0x03)), _mm_set1_epi32(DIFF)));
+        __m128i luma_op = _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_epi32(l, 8), _mm_set1_epi32(0x3F)), _mm_set1_epi32(LUMA)),
+                                       _mm_or_si128(_mm_and_si128(_mm_slli_epi32(l, 12), _mm_set1_epi32(0xF000)),
+                                                    _mm_and_si128(_mm_srli_epi32(l, 8), _mm_set1_epi32(0x0F00))));
+        _mm_storeu_si128((__m128i *)(block->diff_op + 4*i), diff_op);
+        _mm_storeu_si128((__m128i *)(block->luma_op + 4*i), luma_op);
+
+        __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(cur, zero), hash_weights);
+        __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(cur, zero), hash_weights);
+        lo = _mm_shuffle_epi32(_mm_add_epi32(lo, _mm_srli_epi64(lo, 32)), _MM_SHUFFLE(2, 0, 2, 0));
+        hi = _mm_shuffle_epi32(_mm_add_epi32(hi, _mm_srli_epi64(hi, 32)), _MM_SHUFFLE(2, 0, 2, 0));
+        hashes[i] = _mm_and_si128(_mm_unpacklo_epi64(lo, hi), _mm_set1_epi32(63));
+    }
+    __m128i packed = _mm_packus_epi16(_mm_packs_epi32(hashes[0], hashes[1]), _mm_packs_epi32(hashes[2], hashes[3]));
+    _mm_storeu_si128((__m128i *)block->hash, packed);
+}
+
+// Encodes one classified block. The caller guarantees room for the worst case.
+static QOI__ALWAYS_INLINE uint8_t *qoi__emit_block(qoi_state *state, const qoi_rgba *pixels, const qoi__block *block, uint32_t *run_ptr, uint8_t *out, bool opaque) {
+    uint32_t run = *run_ptr;
+    for (uint32_t i = 0, bit = 1; i < QOI__BLOCK_PIXELS; ++i, bit <<= 1) {
+        if (block->run & bit) {
+            // the index gets every RUN pixel, even when the RUN ends on a multiple of 62
+            state->lookup_array[block->hash[i]] = pixels[i];
+            if (++run == 62) {
+                *out++ = RUN | 61;
+                run = 0;
+            }
+            continue;
+        }
+        if (run > 0) {
+            *out++ = RUN | (run - 1);
+            run = 0;
+        }
+
+        uint8_t hash = block->hash[i];
+        if (0 == memcmp(&state->lookup_array[hash], &pixels[i], sizeof(qoi_rgba))) { // INDEX
+            *out++ = hash;
+        }
+        else if (!opaque && (block->alpha & bit)) { // RGBA
+            *out++ = RGBA;
+            memcpy(out, &pixels[i], sizeof(qoi_rgba));
+            out += sizeof(qoi_rgba);
+        }
+        else if (block->diff & bit) { // DIFF
+            *out++ = (uint8_t)block->diff_op[i];
+        }
+        else if (block->luma & bit) { // LUMA
+            *out++ = (uint8_t)block->luma_op[i];
+            *out++ = (uint8_t)(block->luma_op[i] >> 8);
+        }
+        else { // RGB
+            *out++ = RGB;
+            memcpy(out, &pixels[i], sizeof(qoi_rgba) - sizeof(pixels->a));
+            out += sizeof(qoi_rgba) - sizeof(pixels->a);
+        }
+        state->lookup_array[hash] = pixels[i];
+    }
+    state->prev_px = pixels[QOI__BLOCK_PIXELS - 1];
+    *run_ptr = run;
+    return out;
+}
+#endif // QOI__SSE2
+
+// Defines the RGBA encode core for one instruction set: `run_length` measures RUNs and `blocks`
+// is QOI__ENCODE_BLOCKS to classify 16 pixels at a time with SSE2 before the scalar loop,
+// or QOI__NO_BLOCKS. An `opaque` core (1) only takes pixels with alpha 255: the alpha test and
+// the RGBA op are compiled out and each pixel reserves the 4 bytes of an RGB op instead of 5.
+#define QOI__DEFINE_ENCODE_CORE(name, target, run_length, blocks, opaque)                                           \
+target static uint8_t *name(qoi_state *state, const qoi_rgba *pixels, size_t count, uint8_t *out, uint8_t *out_end) { \
+    const qoi_rgba *pixels_end = pixels + count;                                                            \
+    uint32_t run = state->run;                                                                              \
+                                                                                                            \
+    blocks(run_length, opaque)                                                                              \
+                                                                                                            \
+    qoi_rgba prev_px = state->prev_px;                                                                      \
+                                                                                                            \
+    uint8_t type, hash;                                                                                     \
+    int8_t dr, dg, db, dr_dg, db_dg;                                                                        \
+    for (;pixels < pixels_end; ++pixels) {                                                                  \
+        if (0 == memcmp(pixels, &prev_px, sizeof(qoi_rgba))) { /* RUN */                                    \
+            size_t length = run_length(pixels, pixels_end - pixels, prev_px);                               \
+            pixels += length - 1;                                                                           \
+            run += length % 62;                                                                             \
+            size_t full_runs = length / 62 + run / 62;                                                      \
+            run %= 62;                                                                                      \
+            state->lookup_array[qoi_hash(&prev_px)] = prev_px; /* even on a multiple of 62 */               \
+                                                                                                            \
+            if ((size_t)(out_end - out) < full_runs) return NULL;                                           \
+            for (; full_runs > 0; --full_runs) *out++ = RUN | 61;                                           \
+            continue;                                                                                       \
+        }                                                                                                   \
+                                                                                                            \
+        if (out_end - out < ((opaque) ? 4 : 5) + (run > 0)) return NULL; /* pending RUN + RGB(A) */         \
+        if (run > 0) {                                                                                      \
+            *out++ = RUN | (run - 1);                                                                       \
+            run = 0;                                                                                        \
+        }                                                                                                   \
+                                                                                                            \
+        hash = qoi_hash(pixels);                                                                            \
+        if (0 == memcmp(&state->lookup_array[hash], pixels, sizeof(qoi_rgba))) { /* INDEX */                \
+            *out++ = hash;                                                                                  \
+        }                                                                                                   \
+        else if (!(opaque) && pixels->a != prev_px.a) { /* RGBA */                                          \
+            *out++ = RGBA;                                                                                  \
+            memcpy(out, pixels, sizeof(qoi_rgba));                                                          \
+            out += sizeof(qoi_rgba);                                                                        \
+        }                                                                                                   \
+        else {                                                                                              \
+            dr = pixels->r - prev_px.r;                                                                     \
+            dg = pixels->g - prev_px.g;                                                                     \
+            db = pixels->b - prev_px.b;                                                                     \
+            dr_dg = dr - dg;                                                                                \
+            db_dg = db - dg;                                                                                \
+                                                                                                            \
+            if (qoi_between(dr, -2, 1) && qoi_between(dg, -2, 1) && qoi_between(db, -2, 1)) { /* DIFF */    \
+                type = DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);                                     \
+                *out++ = type;                                                                              \
+            }                                                                                               \
+            else if (qoi_between(dg, -32, 31) && qoi_between(dr_dg, -8, 7) && qoi_between(db_dg, -8, 7)) { /* LUMA */ \
+                *out++ = LUMA | (dg + 32);                                                                  \
+                *out++ = (dr_dg + 8) << 4 | (db_dg + 8);                                                    \
+            }                                                                                               \
+            else { /* RGB */                                                                                \
+                *out++ = RGB;                                                                               \
+                memcpy(out, pixels, sizeof(qoi_rgba) - sizeof(pixels->a));                                  \
+                out += sizeof(qoi_rgba) - sizeof(pixels->a);                                                \
+            }                                                                                               \
+        }                                                                                                   \
+                                                                                                            \
+        prev_px = *pixels;                                                                                  \
+        state->lookup_array[hash] = prev_px;                                                                \
+    }                                                                                                       \
+                                                                                                            \
+    state->prev_px = prev_px;                                                                               \
+    state->run = run;                                                                                       \
+    return out;                                                                                             \
+}
+
+#ifdef QOI__SSE2
+#define QOI__ENCODE_BLOCKS(run_length, opaque)                                                              \
+    qoi__block block;                                                                                       \
+    while (pixels_end - pixels >= QOI__BLOCK_PIXELS && out_end - out >= QOI__BLOCK_PIXELS*((opaque) ? 4 : 5) + 1) {\
+        if (0 == memcmp(pixels, &state->prev_px, sizeof(qoi_rgba))) { /* long RUN */                        \
+            size_t length = run_length(pixels, pixels_end - pixels, state->prev_px);                        \
+            pixels += length;                                                                               \
+            run += length % 62;                                                                             \
+            size_t full_runs = length / 62 + run / 62;                                                      \
+            run %= 62;                                                                                      \
+            state->lookup_array[qoi_hash(&state->prev_px)] = state->prev_px;                                \
+                                                                                                            \
+            if ((size_t)(out_end - out) < full_runs) return NULL;                                           \
+            for (; full_runs > 0; --full_runs) *out++ = RUN | 61;                                           \
+            continue;                                                                                       \
+        }                                                                                                   \
+        qoi__classify_block(pixels, state->prev_px, &block, (opaque));                                      \
+        out = qoi__emit_block(state, pixels, &block, &run, out, (opaque));                                  \
+        pixels += QOI__BLOCK_PIXELS;                                                                        \
+    }
+#endif
+#define QOI__NO_BLOCKS(run_length, opaque)
+
+#ifdef QOI__CPU_DISPATCH
+QOI__DEFINE_ENCODE_CORE(qoi__encode_core_scalar,   ,                   qoi__run_length_scalar, QOI__NO_BLOCKS,     0)
+QOI__DEFINE_ENCODE_CORE(qoi__encode_core_sse2,     ,                   qoi__run_length_sse2,   QOI__ENCODE_BLOCKS, 0)
+QOI__DEFINE_ENCODE_CORE(qoi__encode_core_sse41,    QOI__TARGET_SSE41,  qoi__run_length_sse41,  QOI__ENCODE_BLOCKS, 0)
+QOI__DEFINE_ENCODE_CORE(qoi__encode_core_avx2,     QOI__TARGET_AVX2,   qoi__run_length_avx2,   QOI__ENCODE_BLOCKS, 0)
+QOI__DEFINE_ENCODE_CORE(qoi__encode_core_avx512,   QOI__TARGET_AVX512, qoi__run_length_avx512, QOI__ENCODE_BLOCKS, 0)
+QOI__DEFINE_ENCODE_CORE(qoi__encode_opaque_scalar, ,                   qoi__run_length_scalar, QOI__NO_BLOCKS,     1)
+QOI__DEFINE_ENCODE_CORE(qoi__encode_opaque_sse2,   ,                   qoi__run_length_sse2,   QOI__ENCODE_BLOCKS, 1)
+QOI__DEFINE_ENCODE_CORE(qoi__encode_opaque_sse41,  QOI__TARGET_SSE41,  qoi__run_length_sse41,  QOI__ENCODE_BLOCKS, 1)
+QOI__DEFINE_ENCODE_CORE(qoi__encode_opaque_avx2,   QOI__TARGET_AVX2,   qoi__run_length_avx2,   QOI__ENCODE_BLOCKS, 1)
+QOI__DEFINE_ENCODE_CORE(qoi__encode_opaque_avx512, QOI__TARGET_AVX512, qoi__run_length_avx512, QOI__ENCODE_BLOCKS, 1)
+
+#define QOI__KERNEL_TABLE(level, linearize) {                                                               \
+    qoi__decode_core_##level, qoi__decode_rgb_##level, qoi__decode_bgra_##level, qoi__decode_argb_##level,  \
+    qoi__encode_core_##level, qoi__encode_opaque_##level, linearize, qoi__run_length_##level,               \
+}
+
+static const qoi__kernel_table qoi__kernel_tables[] = {
+    [QOI_SIMD_SCALAR] = QOI__KERNEL_TABLE(scalar, qoi__linearize_scalar),
+    [QOI_SIMD_SSE2]   = QOI__KERNEL_TABLE(sse2,   qoi__linearize_scalar),
+    [QOI_SIMD_SSE41]  = QOI__KERNEL_TABLE(sse41,  qoi__linearize_scalar),
+    [QOI_SIMD_AVX2]   = QOI__KERNEL_TABLE(avx2,   qoi__linearize_avx2),
+    [QOI_SIMD_AVX512] = QOI__KERNEL_TABLE(avx512, qoi__linearize_avx512),
+};
+static int qoi__simd_active = -1;
+
+static qoi_simd_level qoi__simd_detect(void) {
+    __builtin_cpu_init();
+    qoi_simd_level level = QOI_SIMD_SSE2;
+    if (__builtin_cpu_supports("sse4.1")) level = QOI_SIMD_SSE41;
+    if (__builtin_cpu_supports("avx2")) level = QOI_SIMD_AVX2;
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) level = QOI_SIMD_AVX512;
+
+    const char *forced = getenv("QOI_SIMD");
+    if (forced == NULL) return level;
+    for (int i = QOI_SIMD_SCALAR; i <= (int)level; ++i) {
+        if (strcmp(forced, qoi_simd_name(i)) == 0) return i;
+    }
+    fprintf(stderr, "[ERROR]: QOI_SIMD=%s isn't a level this CPU supports, using %s!\n", forced, qoi_simd_name(level));
+    return level;
+}
+
+// Every thread detects the same level, so racing first calls only repeat the work
+static const qoi__kernel_table *qoi__kernels(void) {
+    int level = __atomic_load_n(&qoi__simd_active, __ATOMIC_RELAXED);
+    if (level < 0) {
+        level = qoi__simd_detect();
+        __atomic_store_n(&qoi__simd_active, level, __ATOMIC_RELAXED);
+    }
+    return &qoi__kernel_tables[level];
+}
+
+static uint8_t *qoi__encode_pixels(qoi_state *state, const qoi_rgba *pixels, size_t count, uint8_t *out, uint8_t *out_end) {
+    return qoi__kernels()->encode_pixels(state, pixels, count, out, out_end);
+}
+
+QOI__UNUSED static uint8_t *qoi__encode_pixels_opaque(qoi_state *state, const qoi_rgba *pixels, size_t count, uint8_t *out, uint8_t *out_end) {
+    return qoi__kernels()->encode_opaque(state, pixels, count, out, out_end);
+}
+
+qoi_simd_level qoi_simd(void) {
+    qoi__kernels();
+    return qoi__simd_active;
+}
+#else
+#ifdef QOI__SSE2
+QOI__DEFINE_ENCODE_CORE(qoi__encode_pixels,        ,            qoi__run_length, QOI__ENCODE_BLOCKS, 0)
+QOI__DEFINE_ENCODE_CORE(qoi__encode_pixels_opaque, QOI__UNUSED, qoi__run_length, QOI__ENCODE_BLOCKS, 1)
+#else
+QOI__DEFINE_ENCODE_CORE(qoi__encode_pixels,        ,            qoi__run_length, QOI__NO_BLOCKS,     0)
+QOI__DEFINE_ENCODE_CORE(qoi__encode_pixels_opaque, QOI__UNUSED, qoi__run_length, QOI__NO_BLOCKS,     1)
+#endif
+
+qoi_simd_level qoi_simd(void) {
+#if defined(__AVX512BW__)
+    return QOI_SIMD_AVX512;
+#elif defined(__AVX2__)
+    return QOI_SIMD_AVX2;
+#elif defined(__SSE4_1__)
+    return QOI_SIMD_SSE41;
+#elif defined(QOI__SSE2)
+    return QOI_SIMD_SSE2;
+#elif defined(__ARM_NEON)
+    return QOI_SIMD_NEON;
+#else
+    return QOI_SIMD_SCALAR;
+#endif
+}
+#endif // QOI__CPU_DISPATCH
+
+const char *qoi_simd_name(qoi_simd_level level) {
+    switch (level) {
+    case QOI_SIMD_SCALAR: return "scalar";
+    case QOI_SIMD_SSE2:   return "sse2";
+    case QOI_SIMD_SSE41:  return "sse4.1";
+    case QOI_SIMD_AVX2:   return "avx2";
+    case QOI_SIMD_AVX512: return "avx512";
+    case QOI_SIMD_NEON:   return "neon";
+    }
+    return "unknown";
+}
+
+// Defines an encoder for pixels of `step` bytes read through `load(pixels)`. Each chunk is
+// converted with the layout fixed at compile time, then goes through `encode`, the RGBA core or
+// the opaque one, while it is still in cache.
+#define QOI__DEFINE_ENCODE_PIXELS(name, step, load, encode)                                                         \
+static uint8_t *name(qoi_state *state, const uint8_t *pixels, size_t count, uint8_t *out, uint8_t *out_end) { \
+    qoi_rgba chunk[QOI_DECODE_CHUNK];                                                                       \
+    for (size_t i = 0; i < count && out != NULL; i += QOI_DECODE_CHUNK) {                                   \
+        size_t length = count - i < QOI_DECODE_CHUNK ? count - i : QOI_DECODE_CHUNK;                        \
+        for (size_t j = 0; j < length; ++j, pixels += (step)) chunk[j] = load(pixels);                      \
+        out = encode(state, chunk, length, out, out_end);                                                   \
+    }                                                                                                       \
+    return out;                                                                                             \
+}
+
+#define QOI__LOAD_RGB(p)  ((qoi_rgba){ .r = (p)[0], .g = (p)[1], .b = (p)[2], .a = 255 })
+#define QOI__LOAD_BGRA(p) ((qoi_rgba){ .r = (p)[2], .g = (p)[1], .b = (p)[0], .a = (p)[3] })
+#define QOI__LOAD_BGRX(p) ((qoi_rgba){ .r = (p)[2], .g = (p)[1], .b = (p)[0], .a = 255 })
+#define QOI__LOAD_ARGB(p) ((qoi_rgba){ .r = (p)[1], .g = (p)[2], .b = (p)[3], .a = (p)[0] })
+#define QOI__LOAD_XRGB(p) ((qoi_rgba){ .r = (p)[1], .g = (p)[2], .b = (p)[3], .a = 255 })
+
+#ifndef QOI_GENERIC_ONLY
+QOI__DEFINE_ENCODE_PIXELS(qoi__encode_pixels_rgb,  3, QOI__LOAD_RGB,  qoi__encode_pixels_opaque)
+QOI__DEFINE_ENCODE_PIXELS(qoi__encode_pixels_rgbx, 4, QOI__LOAD_RGB,  qoi__encode_pixels_opaque)
+QOI__DEFINE_ENCODE_PIXELS(qoi__encode_pixels_bgra, 4, QOI__LOAD_BGRA, qoi__encode_pixels)
+QOI__DEFINE_ENCODE_PIXELS(qoi__encode_pixels_bgrx, 4, QOI__LOAD_BGRX, qoi__encode_pixels_opaque)
+QOI__DEFINE_ENCODE_PIXELS(qoi__encode_pixels_argb, 4, QOI__LOAD_ARGB, qoi__encode_pixels)
+QOI__DEFINE_ENCODE_PIXELS(qoi__encode_pixels_xrgb, 4, QOI__LOAD_XRGB, qoi__encode_pixels_opaque)
+#endif
+
+static void qoi__load_pixels(qoi_rgba *pixels, const uint8_t *in, size_t count, qoi_layout layout, bool opaque) {
+    size_t step = qoi__layout_size(layout);
+    for (size_t i = 0; i < count; ++i, in += step) {
+        switch (layout) {
+        case QOI_LAYOUT_RGBA: pixels[i] = (qoi_rgba){ .r = in[0], .g = in[1], .b = in[2], .a = in[3] }; break;
+        case QOI_LAYOUT_RGB:  pixels[i] = QOI__LOAD_RGB(in);  break;
+        case QOI_LAYOUT_BGRA: pixels[i] = QOI__LOAD_BGRA(in); break;
+        case QOI_LAYOUT_ARGB: pixels[i] = QOI__LOAD_ARGB(in); break;
+        }
+        if (opaque) pixels[i].a = 255;
+    }
+}
+
+// Encodes `count` pixels stored in `layout` with the loader specialized for it; `opaque` pixels
+// are encoded with alpha 255 whatever their alpha byte says, on the opaque core. With
+// QOI_GENERIC_ONLY every layout is converted to RGBA a chunk at a time for the RGBA core.
+static uint8_t *qoi__encode_layout(qoi_state *state, const uint8_t *pixels, size_t count, qoi_layout layout, bool opaque, uint8_t *out, uint8_t *out_end) {
+    if (layout == QOI_LAYOUT_RGBA && !opaque) return qoi__encode_pixels(state, (const qoi_rgba *)pixels, count, out, out_end);
+#ifndef QOI_GENERIC_ONLY
+    switch (layout) {
+    case QOI_LAYOUT_RGBA: return qoi__encode_pixels_rgbx(state, pixels, count, out, out_end);
+    case QOI_LAYOUT_RGB:  return qoi__encode_pixels_rgb(state, pixels, count, out, out_end);
+    case QOI_LAYOUT_BGRA: return (opaque ? qoi__encode_pixels_bgrx : qoi__encode_pixels_bgra)(state, pixels, count, out, out_end);
+    case QOI_LAYOUT_ARGB: return (opaque ? qoi__encode_pixels_xrgb : qoi__encode_pixels_argb)(state, pixels, count, out, out_end);
+    }
+#endif
+
+    qoi_rgba chunk[QOI_DECODE_CHUNK];
+    size_t step = qoi__layout_size(layout);
+    for (size_t i = 0; i < count && out != NULL; i += QOI_DECODE_CHUNK) {
+        size_t length = count - i < QOI_DECODE_CHUNK ? count - i : QOI_DECODE_CHUNK;
+        qoi__load_pixels(chunk, pixels + i * step, length, layout, opaque);
+        out = qoi__encode_pixels(state, chunk, length, out, out_end);
+    }
+
+    return out;
+}
+
+static uint8_t *qoi__encode_finish(qoi_state *state, uint8_t *out, uint8_t *out_end) {
+    if (out_end - out < (state->run > 0) + QOI_END_SIZE) return NULL;
+    if (state->run > 0) {
+        *out++ = RUN | (state->run - 1);
+        state->run = 0;
+        state->lookup_array[qoi_hash(&state->prev_px)] = state->prev_px;
+    }
+    memcpy(out, QOI_END, QOI_END_SIZE);
+    return out + QOI_END_SIZE;
+}
+
+size_t qoi_encode(void *buffer, size_t buffer_size, uint32_t width, uint32_t height, uint8_t channels, uint8_t colorspace, const qoi_rgba *pixels) {
+    size_t pixel_count = (size_t)width * height;
+    if (pixel_count > QOI_PIXELS_MAX) {
+        fprintf(stderr, "[ERROR]: Image size (%ux%u) exceeds the maximum pixel count!\n", width, height);
+        return 0;
+    }
+    if (buffer_size < QOI_HEADER_SIZE + QOI_END_SIZE) {
+        fprintf(stderr, "[ERROR]: Output buffer (%zu bytes) is too small!\n", buffer_size);
+        return 0;
+    }
+
+    uint8_t *out_end = (uint8_t *)buffer + buffer_size;
+    uint8_t *out = qoi__encode_header(buffer, width, height, channels, colorspace);
+
+    qoi_state state;
+    qoi__state_init(&state);
+
+    out = qoi__encode_pixels(&state, pixels, pixel_count, out, out_end);
+    if (out != NULL) out = qoi__encode_finish(&state, out, out_end);
+    if (out == NULL) {
+        fprintf(stderr, "[ERROR]: Output buffer (%zu bytes) is too small!\n", buffer_size);
+        return 0;
+    }
+
+    return out - (uint8_t *)buffer;
+}
+
+// Grows `bytes` chunk by chunk so it tracks the compressed size instead of the worst case.
+static void qoi__encode_pixels_to_bytes(qoi_state *state, const qoi_rgba *pixels, size_t count, qoi_bytes *bytes) {
+    for (size_t i = 0; i < count; i += QOI_ENCODE_CHUNK) {
+        size_t chunk = count - i < QOI_ENCODE_CHUNK ? count - i : QOI_ENCODE_CHUNK;
+
+        size_t needed = bytes->count + chunk * sizeof(qoi_rgba) + chunk + 1;
+        if (needed > bytes->capacity) qoi_da_reserve(bytes, needed > 2 * bytes->capacity ? needed : 2 * bytes->capacity);
+
+        uint8_t *out = qoi__encode_pixels(state, pixels + i, chunk, bytes->items + bytes->count, bytes->items + bytes->capacity);
+        bytes->count = out - bytes->items;
+    }
+}
+
+bool qoi_encode_to_bytes(qoi_bytes *bytes, uint32_t width, uint32_t height, uint8_t channels, uint8_t colorspace, const qoi_rgba *pixels) {
+    size_t pixel_count = (size_t)width * height;
+    if (pixel_count > QOI_PIXELS_MAX) {
+        fprintf(stderr, "[ERROR]: Image size (%ux%u) exceeds the maximum pixel count!\n", width, height);
+        return false;
+    }
+
+    size_t needed = bytes->count + QOI_HEADER_SIZE + QOI_END_SIZE + 1;
+    if (needed > bytes->capacity) qoi_da_reserve(bytes, needed);
+    uint8_t *out = qoi__encode_header(bytes->items + bytes->count, width, height, channels, colorspace);
+    bytes->count = out - bytes->items;
+
+    qoi_state state;
+    qoi__state_init(&state);
+
+    qoi__encode_pixels_to_bytes(&state, pixels, pixel_count, bytes);
+
+    needed = bytes->count + 1 + QOI_END_SIZE;
+    if (needed > bytes->capacity) qoi_da_reserve(bytes, needed);
+    out = qoi__encode_finish(&state, bytes->items + bytes->count, bytes->items + bytes->capacity);
+    bytes->count = out - bytes->items;
+
+    return true;
+}
+
+// Encodes pixels stored in `layout`. The header gets 3 channels for RGB input, and for any layout
+// when the caller knows every pixel is opaque (`opaque`, the alpha bytes are then ignored).
+size_t qoi_encode_layout(void *buffer, size_t buffer_size, uint32_t width, uint32_t height, uint8_t colorspace, const void *pixels, qoi_layout layout, bool opaque) {
+    size_t pixel_count = (size_t)width * height;
+    if (pixel_count > QOI_PIXELS_MAX) {
+        fprintf(stderr, "[ERROR]: Image size (%ux%u) exceeds the maximum pixel count!\n", width, height);
+        return 0;
+    }
+    if (buffer_size < QOI_HEADER_SIZE + QOI_END_SIZE) {
+        fprintf(stderr, "[ERROR]: Output buffer (%zu bytes) is too small!\n", buffer_size);
+        return 0;
+    }
+
+    opaque = opaque || layout == QOI_LAYOUT_RGB;
+    uint8_t *out_end = (uint8_t *)buffer + buffer_size;
+    uint8_t *out = qoi__encode_header(buffer, width, height, opaque ? 3 : 4, colorspace);
+
+    qoi_state state;
+    qoi__state_init(&state);
+
+    out = qoi__encode_layout(&state, pixels, pixel_count, layout, opaque, out, out_end);
+    if (out != NULL) out = qoi__encode_finish(&state, out, out_end);
+    if (out == NULL) {
+        fprintf(stderr, "[ERROR]: Output buffer (%zu bytes) is too small!\n", buffer_size);
+        return 0;
+    }
+
+    return out - (uint8_t *)buffer;
+}
+
+bool qoi_encode_to_bytes_layout(qoi_bytes *bytes, uint32_t width, uint32_t height, uint8_t colorspace, const void *pixels, qoi_layout layout, bool opaque) {
+    size_t pixel_count = (size_t)width * height;
+    if (pixel_count > QOI_PIXELS_MAX) {
+        fprintf(stderr, "[ERROR]: Image size (%ux%u) exceeds the maximum pixel count!\n", width, height);
+        return false;
+    }
+
+    // the opaque cores never write an RGBA op
+    size_t capacity = qoi__encoded_size_bound(pixel_count, opaque || layout == QOI_LAYOUT_RGB);
+
+    qoi_da_reserve(bytes, bytes->count + capacity);
+    size_t size = qoi_encode_layout(bytes->items + bytes->count, capacity, width, height, colorspace, pixels, layout, opaque);
+    bytes->count += size;
+    return size > 0;
+}
+
+// Encodes packed 3-byte RGB pixels; the header gets 3 channels.
+size_t qoi_encode_rgb(void *buffer, size_t buffer_size, uint32_t width, uint32_t height, uint8_t colorspace, const uint8_t *pixels) {
+    return qoi_encode_layout(buffer, buffer_size, width, height, colorspace, pixels, QOI_LAYOUT_RGB, true);
+}
+
+bool qoi_encode_to_bytes_rgb(qoi_bytes *bytes, uint32_t width, uint32_t height, uint8_t colorspace, const uint8_t *pixels) {
+    return qoi_encode_to_bytes_layout(bytes, width, height, colorspace, pixels, QOI_LAYOUT_RGB, true);
+}
+
+void qoi_free_bytes(qoi_bytes *bytes) {
+    QOI_Free(bytes->items);
+    bytes->items = NULL;
+    bytes->count = 0;
+    bytes->capacity = 0;
+}
+
+static bool qoi__write_file(const char *filepath, const qoi_bytes *bytes) {
+    FILE *fd = fopen(filepath, "wb");
+    if (NULL == fd) {
+        fprintf(stderr, "[ERROR]: Couldn't open file: %s\n", filepath);
+        return false;
+    }
+
+    bool result = fwrite(bytes->items, 1, bytes->count, fd) == bytes->count;
+    if (!result) {
+        fprintf(stderr, "[ERROR]: Couldn't write file: %s\n", filepath);
+    }
+
+    if (fclose(fd) != 0) result = false;
+    return result;
+}
+
+bool qoi_write_image(const char* filepath, uint32_t width, uint32_t height, uint8_t channels, uint8_t colorspace, qoi_rgba* pixels) {
+    qoi_bytes bytes = {0};
+    if (!qoi_encode_to_bytes(&bytes, width, height, channels, colorspace, pixels)) {
+        return false;
+    }
+
+    bool result = qoi__write_file(filepath, &bytes);
+    qoi_free_bytes(&bytes);
+    return result;
+}
+
+bool qoi_write_image_rgb(const char *filepath, uint32_t width, uint32_t height, uint8_t colorspace, const uint8_t *pixels) {
+    qoi_bytes bytes = {0};
+    bool result = qoi_encode_to_bytes_rgb(&bytes, width, height, colorspace, pixels) && qoi__write_file(filepath, &bytes);
+    qoi_free_bytes(&bytes);
+    return result;
+}
+
+// Decodes on the calling thread into ctx->image, reusing its pixel buffer.
+bool qoi_ctx_decode(qoi_ctx *ctx, const void *data, size_t data_size) {
+    ctx->image.image_data.count = 0;
+    return qoi_decode_parallel(data, data_size, &ctx->image, 1);
+}
+
+// Reads the whole file into ctx->input with plain reads (no stdio buffer), reusing its buffer.
+bool qoi_ctx_read_file(qoi_ctx *ctx, const char *filepath) {
+#ifndef _WIN32
+    int fd = open(filepath, O_RDONLY);
+#else
+    int fd = _open(filepath, _O_RDONLY | _O_BINARY);
+#endif
+    if (fd < 0) {
+        fprintf(stderr, "[ERROR]: Couldn't open file %s!\n", filepath);
+        return false;
+    }
+
+    bool result = true;
+    ctx->input.count = 0;
+    for (;;) {
+        if (ctx->input.count + QOI_READ_CHUNK > ctx->input.capacity) {
+            qoi_da_reserve(&ctx->input, ctx->input.capacity == 0 ? QOI_READ_CHUNK : ctx->input.capacity * 2);
+        }
+        size_t space = ctx->input.capacity - ctx->input.count;
+        if (space > 0x40000000) space = 0x40000000; // keeps the size within a single read call
+#ifndef _WIN32
+        ssize_t read_count = read(fd, ctx->input.items + ctx->input.count, space);
+        if (read_count < 0 && errno == EINTR) continue;
+#else
+        int read_count = _read(fd, ctx->input.items + ctx->input.count, (unsigned)space);
+#endif
+        if (read_count < 0) {
+            fprintf(stderr, "[ERROR]: Couldn't read file %s!\n", filepath);
+            result = false;
+            break;
+        }
+        if (read_count == 0) break;
+        ctx->input.count += read_count;
+    }
+
+#ifndef _WIN32
+    close(fd);
+#else
+    _close(fd);
+#endif
+    return result;
+}
+
+// Reads the file into ctx->input and decodes it into ctx->image.
+bool qoi_ctx_load_image(qoi_ctx *ctx, const char *filepath) {
+    return qoi_ctx_read_file(ctx, filepath) && qoi_ctx_decode(ctx, ctx->input.items, ctx->input.count);
+}
+
+// Encodes into ctx->encoded, reusing its buffer.
+bool qoi_ctx_encode(qoi_ctx *ctx, uint32_t width, uint32_t height, uint8_t channels, uint8_t colorspace, const qoi_rgba *pixels) {
+    ctx->encoded.count = 0;
+    return qoi_encode_to_bytes(&ctx->encoded, width, height, channels, colorspace, pixels);
+}
+
+bool qoi_ctx_write_image(qoi_ctx *ctx, const char *filepath, uint32_t width, uint32_t height, uint8_t channels, uint8_t colorspace, const qoi_rgba *pixels) {
+    return qoi_ctx_encode(ctx, width, height, channels, colorspace, pixels) && qoi__write_file(filepath, &ctx->encoded);
+}
+
+bool qoi_ctx_write_image_layout(qoi_ctx *ctx, const char *filepath, uint32_t width, uint32_t height, uint8_t colorspace, const void *pixels, qoi_layout layout, bool opaque) {
+    ctx->encoded.count = 0;
+    return qoi_encode_to_bytes_layout(&ctx->encoded, width, height, colorspace, pixels, layout, opaque) && qoi__write_file(filepath, &ctx->encoded);
+}
+
+// Writes the last encoded image in ctx->encoded to a file.
+bool qoi_ctx_write_file(qoi_ctx *ctx, const char *filepath) {
+    return qoi__write_file(filepath, &ctx->encoded);
+}
+
+void qoi_ctx_free(qoi_ctx *ctx) {
+    qoi_free_image(&ctx->image);
+    qoi_free_bytes(&ctx->input);
+    qoi_free_bytes(&ctx->encoded);
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+bool qoi_file_writer(void *file, const void *data, size_t size) {
+    return fwrite(data, 1, size, file) == size;
+}
+
+bool qoi_bytes_writer(void *bytes, const void *data, size_t size) {
+    qoi_bytes *da = bytes;
+    if (da->count + size > da->capacity) qoi_da_reserve(da, da->count + size > 2 * da->capacity ? da->count + size : 2 * da->capacity);
+    memcpy(da->items + da->count, data, size);
+    da->count += size;
+    return true;
+}
+
+static bool qoi__encoder_flush(qoi_encoder *encoder) {
+    if (encoder->count == 0) return true;
+    if (!encoder->write(encoder->user, encoder->buffer, encoder->count)) {
+        fprintf(stderr, "[ERROR]: Couldn't write encoded data!\n");
+        return false;
+    }
+    encoder->count = 0;
+    return true;
+}
+
+bool qoi_encoder_begin(qoi_encoder *encoder, uint32_t width, uint32_t height, uint8_t channels, uint8_t colorspace, qoi_write_func write, void *user) {
+    if ((size_t)width * height > QOI_PIXELS_MAX) {
+        fprintf(stderr, "[ERROR]: Image size (%ux%u) exceeds the maximum pixel count!\n", width, height);
+        return false;
+    }
+
+    qoi__state_init(&encoder->state);
+    encoder->width  = width;
+    encoder->height = height;
+    encoder->row    = 0;
+    encoder->write  = write;
+    encoder->user   = user;
+    encoder->count  = qoi__encode_header(encoder->buffer, width, height, channels, colorspace) - encoder->buffer;
+    return true;
+}
+
+bool qoi_encoder_push_rows(qoi_encoder *encoder, const qoi_rgba *pixels, uint32_t rows) {
+    if (rows > encoder->height - encoder->row) {
+        fprintf(stderr, "[ERROR]: Pushed more rows than the image height (%u)!\n", encoder->height);
+        return false;
+    }
+
+    // every chunk fits into the buffer even if all of its pixels become RGBA ops
+    const size_t max_chunk = (QOI_STREAM_BUFFER_SIZE - 1) / (sizeof(qoi_rgba) + 1);
+    size_t count = (size_t)rows * encoder->width;
+    while (count > 0) {
+        size_t chunk = count < max_chunk ? count : max_chunk;
+        if (QOI_STREAM_BUFFER_SIZE - encoder->count < chunk * (sizeof(qoi_rgba) + 1) + 1) {
+            if (!qoi__encoder_flush(encoder)) return false;
+        }
+
+        uint8_t *out = qoi__encode_pixels(&encoder->state, pixels, chunk, encoder->buffer + encoder->count, encoder->buffer + QOI_STREAM_BUFFER_SIZE);
+        encoder->count = out - encoder->buffer;
+        pixels += chunk;
+        count -= chunk;
+    }
+
+    encoder->row += rows;
+    return true;
+}
+
+bool qoi_encoder_finish(qoi_encoder *encoder) {
+    if (encoder->row != encoder->height) {
+        fprintf(stderr, "[ERROR]: Only %u of %u rows were pushed!\n", encoder->row, encoder->height);
+        return false;
+    }
+
+    if (QOI_STREAM_BUFFER_SIZE - encoder->count < 1 + QOI_END_SIZE) {
+        if (!qoi__encoder_flush(encoder)) return false;
+    }
+    uint8_t *out = qoi__encode_finish(&encoder->state, encoder->buffer + encoder->count, encoder->buffer + QOI_STREAM_BUFFER_SIZE);
+    encoder->count = out - encoder->buffer;
+
+    return qoi__encoder_flush(encoder);
+}
+
+static void qoi__write_checkpoint(uint8_t *out, uint32_t offset, const qoi_state *state) {
+    qoi__write_u32be(out, offset);
+    out[4] = state->run;
+    memcpy(out + 5, &state->prev_px, sizeof(qoi_rgba));
+    memcpy(out + 9, state->lookup_array, sizeof(state->lookup_array));
+}
+
+bool qoi_encode_to_bytes_indexed(qoi_bytes *bytes, uint32_t width, uint32_t height, uint8_t channels, uint8_t colorspace, const qoi_rgba *pixels, uint32_t rows_per_checkpoint) {
+    size_t pixel_count = (size_t)width * height;
+    if (pixel_count > QOI_PIXELS_MAX) {
+        fprintf(stderr, "[ERROR]: Image size (%ux%u) exceeds the maximum pixel count!\n", width, height);
+        return false;
+    }
+    if (rows_per_checkpoint == 0) {
+        rows_per_checkpoint = width > 0 && width < QOI_INDEX_BAND_PIXELS ? QOI_INDEX_BAND_PIXELS / width : 1;
+    }
+
+    size_t start = bytes->count;
+    size_t needed = bytes->count + QOI_HEADER_SIZE + QOI_END_SIZE + 1;
+    if (needed > bytes->capacity) qoi_da_reserve(bytes, needed);
+    uint8_t *out = qoi__encode_header(bytes->items + bytes->count, width, height, channels, colorspace);
+    bytes->count = out - bytes->items;
+
+    uint32_t checkpoint_count = height > 0 ? (height - 1) / rows_per_checkpoint : 0;
+    uint8_t *checkpoints = QOI_Malloc((size_t)checkpoint_count * QOI_CHECKPOINT_SIZE + 1);
+    if (checkpoints == NULL) {
+        fprintf(stderr, "[ERROR]: Couldn't allocate the seek index!\n");
+        return false;
+    }
+
+    qoi_state state;
+    qoi__state_init(&state);
+
+    for (uint32_t row = 0, i = 0; row < height; row += rows_per_checkpoint) {
+        if (row > 0) {
+            qoi__write_checkpoint(checkpoints + i++ * QOI_CHECKPOINT_SIZE, bytes->count - start, &state);
+        }
+        uint32_t rows = height - row < rows_per_checkpoint ? height - row : rows_per_checkpoint;
+        qoi__encode_pixels_to_bytes(&state, pixels + (size_t)row * width, (size_t)rows * width, bytes);
+    }
+
+    needed = bytes->count + 1 + QOI_END_SIZE + (size_t)checkpoint_count * QOI_CHECKPOINT_SIZE + QOI_INDEX_FOOTER_SIZE;
+    if (needed > bytes->capacity) qoi_da_reserve(bytes, needed);
+    out = qoi__encode_finish(&state, bytes->items + bytes->count, bytes->items + bytes->capacity);
+
+    memcpy(out, checkpoints, (size_t)checkpoint_count * QOI_CHECKPOINT_SIZE);
+    out += (size_t)checkpoint_count * QOI_CHECKPOINT_SIZE;
+    qoi__write_u32be(out, checkpoint_count);
+    qoi__write_u32be(out + 4, rows_per_checkpoint);
+    memcpy(out + 8, QOI_INDEX_MAGIC, 4);
+    bytes->count = out + QOI_INDEX_FOOTER_SIZE - bytes->items;
+
+    QOI_Free(checkpoints);
+    return true;
+}
+
+bool qoi_write_image_indexed(const char *filepath, uint32_t width, uint32_t height, uint8_t channels, uint8_t colorspace, qoi_rgba *pixels, uint32_t rows_per_checkpoint) {
+    qoi_bytes bytes = {0};
+    if (!qoi_encode_to_bytes_indexed(&bytes, width, height, channels, colorspace, pixels, rows_per_checkpoint)) {
+        return false;
+    }
+
+    bool result = qoi__write_file(filepath, &bytes);
+    qoi_free_bytes(&bytes);
+    return result;
+}
+
+// The encoder state at any pixel depends only on the pixels before it: `prev_px` is the previous
+// pixel and every index slot holds the last earlier pixel with that hash. So stripes can be encoded
+// independently once each stripe's last pixel per slot is known, and only the RUN ops crossing
+// stripe boundaries need to be re-emitted when the stripes are stitched together.
+typedef struct {
+    const qoi_rgba *pixels;
+    size_t    start;
+    size_t    end;
+    qoi_rgba  last[64];
+    uint64_t  last_mask;
+    qoi_state state;
+    size_t    lead; // leading pixels that continue the previous stripe's RUN
+    qoi_bytes bytes;
+} qoi__stripe;
+
+static void qoi__stripe_scan(void *item) {
+    qoi__stripe *stripe = item;
+
+    stripe->last_mask = 0;
+    for (size_t i = stripe->end; i-- > stripe->start && stripe->last_mask != UINT64_MAX;) {
+        const qoi_rgba *px = &stripe->pixels[i];
+        if (i + 1 < stripe->end && 0 == memcmp(px, px + 1, sizeof(qoi_rgba))) continue;
+
+        uint8_t hash = qoi_hash(px);
+        if (stripe->last_mask >> hash & 1) continue;
+        stripe->last_mask |= (uint64_t)1 << hash;
+        stripe->last[hash] = *px;
+    }
+}
+
+static void qoi__stripe_encode(void *item) {
+    qoi__stripe *stripe = item;
+    const qoi_rgba *pixels = stripe->pixels + stripe->start;
+    const qoi_rgba *pixels_end = stripe->pixels + stripe->end;
+    qoi_rgba prev_px = stripe->state.prev_px;
+
+    stripe->lead = qoi__run_length(pixels, pixels_end - pixels, prev_px);
+    pixels += stripe->lead;
+    if (stripe->lead > 0) {
+        stripe->state.lookup_array[qoi_hash(&prev_px)] = prev_px;
+    }
+
+    qoi__encode_pixels_to_bytes(&stripe->state, pixels, pixels_end - pixels, &stripe->bytes);
+}
+
+static size_t qoi__run_size(size_t run) {
+    return (run + 61) / 62;
+}
+
+static uint8_t *qoi__encode_run(uint8_t *out, size_t run) {
+    for (; run > 62; run -= 62) *out++ = RUN | 61;
+    if (run > 0) *out++ = RUN | (run - 1);
+    return out;
+}
+
+static qoi__stripe *qoi__encode_stripes(const qoi_rgba *pixels, size_t pixel_count, uint32_t thread_count, uint32_t *stripe_count) {
+    if (thread_count == 0) thread_count = qoi_cpu_count();
+
+    size_t count = (size_t)thread_count * 4;
+    if (count > pixel_count / QOI_PARALLEL_MIN_PIXELS) count = pixel_count / QOI_PARALLEL_MIN_PIXELS;
+    if (count == 0) count = 1;
+
+    qoi__stripe *stripes = QOI_Calloc(count, sizeof(qoi__stripe));
+    if (stripes == NULL) {
+        fprintf(stderr, "[ERROR]: Couldn't allocate stripes!\n");
+        return NULL;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        stripes[i].pixels = pixels;
+        stripes[i].start  = pixel_count * i / count;
+        stripes[i].end    = pixel_count * (i + 1) / count;
+    }
+
+    qoi__parallel_for(qoi__stripe_scan, stripes, sizeof(qoi__stripe), count - 1, thread_count);
+
+    qoi_state state;
+    qoi__state_init(&state);
+    for (size_t i = 0; i < count; ++i) {
+        stripes[i].state = state;
+        if (stripes[i].end > stripes[i].start) state.prev_px = pixels[stripes[i].end - 1];
+        for (uint32_t slot = 0; slot < 64; ++slot) {
+            if (stripes[i].last_mask >> slot & 1) state.lookup_array[slot] = stripes[i].last[slot];
+        }
+    }
+
+    qoi__parallel_for(qoi__stripe_encode, stripes, sizeof(qoi__stripe), count, thread_count);
+
+    *stripe_count = count;
+    return stripes;
+}
+
+static size_t qoi__stripes_size(const qoi__stripe *stripes, uint32_t stripe_count) {
+    size_t size = QOI_HEADER_SIZE + QOI_END_SIZE;
+    size_t run = 0;
+    for (uint32_t i = 0; i < stripe_count; ++i) {
+        run += stripes[i].lead;
+        if (stripes[i].lead == stripes[i].end - stripes[i].start) continue;
+        size += qoi__run_size(run) + stripes[i].bytes.count;
+        run = stripes[i].state.run;
+    }
+
+    return size + qoi__run_size(run);
+}
+
+static uint8_t *qoi__stitch_stripes(uint8_t *out, const qoi__stripe *stripes, uint32_t stripe_count) {
+    size_t run = 0;
+    for (uint32_t i = 0; i < stripe_count; ++i) {
+        run += stripes[i].lead;
+        if (stripes[i].lead == stripes[i].end - stripes[i].start) continue;
+        out = qoi__encode_run(out, run);
+        memcpy(out, stripes[i].bytes.items, stripes[i].bytes.count);
+        out += stripes[i].bytes.count;
+        run = stripes[i].state.run;
+    }
+
+    out = qoi__encode_run(out, run);
+    memcpy(out, QOI_END, QOI_END_SIZE);
+    return out + QOI_END_SIZE;
+}
+
+static void qoi__free_stripes(qoi__stripe *stripes, uint32_t stripe_count) {
+    for (uint32_t i = 0; i < stripe_count; ++i) {
+        qoi_free_bytes(&stripes[i].bytes);
+    }
+    QOI_Free(stripes);
+}
+
+size_t qoi_encode_parallel(void *buffer, size_t buffer_size, uint32_t width, uint32_t height, uint8_t channels, uint8_t colorspace, const qoi_rgba *pixels, uint32_t thread_count) {
+    size_t pixel_count = (size_t)width * height;
+    if (pixel_count > QOI_PIXELS_MAX) {
+        fprintf(stderr, "[ERROR]: Image size (%ux%u) exceeds the maximum pixel count!\n", width, height);
+        return 0;
+    }
+
+    uint32_t stripe_count;
+    qoi__stripe *stripes = qoi__encode_stripes(pixels, pixel_count, thread_count, &stripe_count);
+    if (stripes == NULL) return 0;
+
+    size_t size = qoi__stripes_size(stripes, stripe_count);
+    if (buffer_size < size) {
+        fprintf(stderr, "[ERROR]: Output buffer (%zu bytes) is too small!\n", buffer_size);
+        qoi__free_stripes(stripes, stripe_count);
+        return 0;
+    }
+
+    uint8_t *out = qoi__encode_header(buffer, width, height, channels, colorspace);
+    qoi__stitch_stripes(out, stripes, stripe_count);
+
+    qoi__free_stripes(stripes, stripe_count);
+    return size;
+}
+
+bool qoi_encode_to_bytes_parallel(qoi_bytes *bytes, uint32_t width, uint32_t height, uint8_t channels, uint8_t colorspace, const qoi_rgba *pixels, uint32_t thread_count) {
+    size_t pixel_count = (size_t)width * height;
+    if (pixel_count > QOI_PIXELS_MAX) {
+        fprintf(stderr, "[ERROR]: Image size (%ux%u) exceeds the maximum pixel count!\n", width, height);
+        return false;
+    }
+
+    uint32_t stripe_count;
+    qoi__stripe *stripes = qoi__encode_stripes(pixels, pixel_count, thread_count, &stripe_count);
+    if (stripes == NULL) return false;
+
+    size_t size = qoi__stripes_size(stripes, stripe_count);
+    if (bytes->count + size > bytes->capacity) qoi_da_reserve(bytes, bytes->count + size);
+
+    uint8_t *out = qoi__encode_header(bytes->items + bytes->count, width, height, channels, colorspace);
+    qoi__stitch_stripes(out, stripes, stripe_count);
+    bytes->count += size;
+
+    qoi__free_stripes(stripes, stripe_count);
+    return true;
+}
+
+bool qoi_write_image_parallel(const char *filepath, uint32_t width, uint32_t height, uint8_t channels, uint8_t colorspace, qoi_rgba *pixels, uint32_t thread_count) {
+    qoi_bytes bytes = {0};
+    if (!qoi_encode_to_bytes_parallel(&bytes, width, height, channels, colorspace, pixels, thread_count)) {
+        return false;
+    }
+
+    bool result = qoi__write_file(filepath, &bytes);
+    qoi_free_bytes(&bytes);
+    return result;
+}
+
 #endif // QOI_IMPLEMENTATION
\ No newline at end of file
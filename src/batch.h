@@ -0,0 +1,512 @@
+// Helpers shared by the tools that work on many files: collecting input paths from files,
+// directories, globs and list files, naming outputs, and a work-stealing pool to run the jobs.
+// Include after qoi.h with QOI_IMPLEMENTATION.
+#ifndef BATCH_H_
+#define BATCH_H_
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <glob.h>
+#include <time.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define BATCH_UNUSED __attribute__((unused)) // not every tool uses every helper
+#else
+#define BATCH_UNUSED
+#endif
+
+typedef struct {
+    char **items;
+    size_t count;
+    size_t capacity;
+} Paths;
+
+static char *join_path(const char *parent, const char *name) {
+    size_t parent_size = strlen(parent), name_size = strlen(name);
+    char *path = malloc(parent_size + name_size + 2);
+    assert(path != NULL && "Get MORE RAM!");
+    memcpy(path, parent, parent_size);
+    path[parent_size] = '/';
+    memcpy(path + parent_size + 1, name, name_size + 1);
+    return path;
+}
+
+static char *copy_path(const char *path) {
+    char *copy = malloc(strlen(path) + 1);
+    assert(copy != NULL && "Get MORE RAM!");
+    strcpy(copy, path);
+    return copy;
+}
+
+static void free_paths(Paths *paths) {
+    for (size_t i = 0; i < paths->count; ++i) free(paths->items[i]);
+    free(paths->items);
+    memset(paths, 0, sizeof(*paths));
+}
+
+static bool has_extension(const char *name, const char *extension) {
+    size_t size = strlen(name), extension_size = strlen(extension);
+    return size > extension_size && strcmp(name + size - extension_size, extension) == 0;
+}
+
+static const char *base_name(const char *path) {
+    const char *base = path;
+    for (const char *p = path; *p != '\0'; ++p) {
+        if (*p == '/' || *p == '\\') base = p + 1;
+    }
+    return base;
+}
+
+// `input` with its extension replaced by `extension`, in `output_dir` when there is one and
+// next to the input otherwise.
+BATCH_UNUSED static char *output_path(const char *output_dir, const char *input, const char *extension) {
+    const char *base = output_dir != NULL ? base_name(input) : input;
+    const char *dot = strrchr(base_name(base), '.');
+    size_t stem_size = dot != NULL ? (size_t)(dot - base) : strlen(base);
+    size_t dir_size = output_dir != NULL ? strlen(output_dir) + 1 : 0;
+
+    char *path = malloc(dir_size + stem_size + strlen(extension) + 1);
+    assert(path != NULL && "Get MORE RAM!");
+    if (output_dir != NULL) {
+        memcpy(path, output_dir, dir_size - 1);
+        path[dir_size - 1] = '/';
+    }
+    memcpy(path + dir_size, base, stem_size);
+    strcpy(path + dir_size + stem_size, extension);
+    return path;
+}
+
+typedef struct {
+    const char *output;
+    size_t      input;
+} Output_Entry;
+
+static int compare_outputs(const Output_Entry *a, const Output_Entry *b) {
+#ifdef _WIN32
+    return _stricmp(a->output, b->output);
+#else
+    return strcmp(a->output, b->output);
+#endif
+}
+
+// By output path, and in input order among equal outputs.
+static int compare_output_entries(const void *a, const void *b) {
+    const Output_Entry *entry_a = a, *entry_b = b;
+    int order = compare_outputs(entry_a, entry_b);
+    if (order != 0) return order;
+    return entry_a->input < entry_b->input ? -1 : entry_a->input > entry_b->input;
+}
+
+// Whether two paths name the same file, however they are spelled (`dir//a.png`, `./dir/a.png`).
+static bool same_file(const char *a, const char *b) {
+#ifdef _WIN32
+    char full_a[MAX_PATH], full_b[MAX_PATH];
+    if (GetFullPathNameA(a, MAX_PATH, full_a, NULL) == 0 || GetFullPathNameA(b, MAX_PATH, full_b, NULL) == 0) return false;
+    return _stricmp(full_a, full_b) == 0;
+#else
+    struct stat st_a, st_b;
+    if (stat(a, &st_a) != 0 || stat(b, &st_b) != 0) return false;
+    return st_a.st_dev == st_b.st_dev && st_a.st_ino == st_b.st_ino;
+#endif
+}
+
+// With -output-dir inputs from different directories can get the same output path; converting
+// both would race on the file and silently lose one of them, so every clash is reported instead.
+// The same file reached twice (`dir/ dir/*.png`) isn't a clash: its later copies are dropped from
+// `inputs` and `outputs`, keeping the first one in place.
+BATCH_UNUSED static bool unique_outputs(Paths *inputs, char **outputs) {
+    Output_Entry *entries = malloc((inputs->count + 1) * sizeof(Output_Entry));
+    bool *dropped = calloc(inputs->count + 1, sizeof(bool));
+    assert(entries != NULL && dropped != NULL && "Get MORE RAM!");
+    for (size_t i = 0; i < inputs->count; ++i) entries[i] = (Output_Entry){ .output = outputs[i], .input = i };
+    qsort(entries, inputs->count, sizeof(Output_Entry), compare_output_entries);
+
+    bool result = true;
+    for (size_t first = 0, i = 1; i < inputs->count; ++i) {
+        if (compare_outputs(&entries[first], &entries[i]) != 0) {
+            first = i;
+            continue;
+        }
+        const char *kept = inputs->items[entries[first].input], *input = inputs->items[entries[i].input];
+        if (same_file(kept, input)) {
+            dropped[entries[i].input] = true;
+            continue;
+        }
+        fprintf(stderr, "ERROR: %s and %s would both be written to %s\n", kept, input, entries[i].output);
+        result = false;
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i < inputs->count; ++i) {
+        if (dropped[i]) {
+            free(inputs->items[i]);
+            free(outputs[i]);
+            continue;
+        }
+        inputs->items[count] = inputs->items[i];
+        outputs[count] = outputs[i];
+        count += 1;
+    }
+    inputs->count = count;
+
+    free(dropped);
+    free(entries);
+    return result;
+}
+
+BATCH_UNUSED static uint64_t file_size(const char *path) {
+#ifdef _WIN32
+    struct _stat64 st;
+    return _stat64(path, &st) == 0 ? (uint64_t)st.st_size : 0;
+#else
+    struct stat st;
+    return stat(path, &st) == 0 ? (uint64_t)st.st_size : 0;
+#endif
+}
+
+// Directories are walked recursively for files with `extension`; other paths are taken as they
+// are when given directly (`top_level`) and filtered by `extension` otherwise. Symlinked (or
+// junctioned) directories are only followed when given directly, so a link cycle can't recurse.
+static bool collect_paths(const char *path, const char *extension, Paths *paths, bool top_level) {
+#ifdef _WIN32
+    DWORD attributes = GetFileAttributesA(path);
+    if (attributes == INVALID_FILE_ATTRIBUTES) {
+        fprintf(stderr, "ERROR: Could not stat %s\n", path);
+        return false;
+    }
+    if (!(attributes & FILE_ATTRIBUTE_DIRECTORY)) {
+        if (top_level || has_extension(path, extension)) qoi_da_append(paths, copy_path(path));
+        return true;
+    }
+
+    char *pattern = join_path(path, "*");
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA(pattern, &data);
+    free(pattern);
+    if (find == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "ERROR: Could not open directory %s\n", path);
+        return false;
+    }
+
+    bool result = true;
+    do {
+        if (strcmp(data.cFileName, ".") == 0 || strcmp(data.cFileName, "..") == 0) continue;
+        char *child = join_path(path, data.cFileName);
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            if (!(data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)) result = collect_paths(child, extension, paths, false) && result;
+            free(child);
+        }
+        else if (has_extension(data.cFileName, extension)) {
+            qoi_da_append(paths, child);
+        }
+        else {
+            free(child);
+        }
+    } while (FindNextFileA(find, &data));
+
+    FindClose(find);
+    return result;
+#else
+    struct stat st;
+    if ((top_level ? stat(path, &st) : lstat(path, &st)) != 0) {
+        fprintf(stderr, "ERROR: Could not stat %s\n", path);
+        return false;
+    }
+    if (S_ISLNK(st.st_mode) && (stat(path, &st) != 0 || S_ISDIR(st.st_mode))) return true;
+    if (!S_ISDIR(st.st_mode)) {
+        if (top_level || (S_ISREG(st.st_mode) && has_extension(path, extension))) qoi_da_append(paths, copy_path(path));
+        return true;
+    }
+
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        fprintf(stderr, "ERROR: Could not open directory %s\n", path);
+        return false;
+    }
+
+    bool result = true;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        char *child = join_path(path, entry->d_name);
+        result = collect_paths(child, extension, paths, false) && result;
+        free(child);
+    }
+
+    closedir(dir);
+    return result;
+#endif
+}
+
+// Expands a wildcard pattern (the shell may not have, e.g. inside a list file); every match is
+// collected like a path found in a directory.
+static bool collect_glob(const char *pattern, const char *extension, Paths *paths) {
+#ifdef _WIN32
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA(pattern, &data);
+    if (find == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "ERROR: No file matches %s\n", pattern);
+        return false;
+    }
+
+    const char *base = base_name(pattern);
+    char *dir = malloc(base - pattern + 1);
+    assert(dir != NULL && "Get MORE RAM!");
+    memcpy(dir, pattern, base - pattern);
+    dir[base - pattern] = '\0';
+
+    bool result = true;
+    do {
+        if (strcmp(data.cFileName, ".") == 0 || strcmp(data.cFileName, "..") == 0) continue;
+        char *match = malloc(strlen(dir) + strlen(data.cFileName) + 1);
+        assert(match != NULL && "Get MORE RAM!");
+        strcpy(match, dir);
+        strcat(match, data.cFileName);
+        result = collect_paths(match, extension, paths, false) && result;
+        free(match);
+    } while (FindNextFileA(find, &data));
+
+    FindClose(find);
+    free(dir);
+    return result;
+#else
+    glob_t matches;
+    if (glob(pattern, 0, NULL, &matches) != 0) {
+        fprintf(stderr, "ERROR: No file matches %s\n", pattern);
+        return false;
+    }
+
+    bool result = true;
+    for (size_t i = 0; i < matches.gl_pathc; ++i) {
+        result = collect_paths(matches.gl_pathv[i], extension, paths, false) && result;
+    }
+
+    globfree(&matches);
+    return result;
+#endif
+}
+
+static bool collect_input(const char *input, const char *extension, Paths *paths) {
+    if (strpbrk(input, "*?[") != NULL) return collect_glob(input, extension, paths);
+    return collect_paths(input, extension, paths, true);
+}
+
+// Every non-empty line of the list file is an input; lines starting with # are skipped.
+BATCH_UNUSED static bool collect_list(const char *list_path, const char *extension, Paths *paths) {
+    FILE *file = fopen(list_path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "ERROR: Could not open %s\n", list_path);
+        return false;
+    }
+
+    bool result = true;
+    char line[4096];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') continue;
+        result = collect_input(line, extension, paths) && result;
+    }
+
+    fclose(file);
+    return result;
+}
+
+typedef void (*Job_Func)(void *worker, size_t job);
+
+typedef struct {
+    size_t   *jobs;
+    size_t    head; // the owner takes jobs from the head
+    size_t    tail; // thieves take them from the tail
+    qoi_mutex mutex;
+} Deque;
+
+typedef struct {
+    Deque   *deques;
+    size_t   deque_count;
+    size_t   index;
+    void    *worker;
+    Job_Func func;
+} Pool_Thread;
+
+typedef struct {
+    uint64_t cost;
+    size_t   job;
+} Job_Cost;
+
+static int compare_job_costs(const void *a, const void *b) {
+    uint64_t cost_a = ((const Job_Cost *)a)->cost, cost_b = ((const Job_Cost *)b)->cost;
+    return cost_a < cost_b ? 1 : cost_a > cost_b ? -1 : 0;
+}
+
+static bool deque_take(Deque *deque, bool steal, size_t *job) {
+    qoi_mutex_lock(&deque->mutex);
+    bool found = deque->head < deque->tail;
+    if (found) *job = steal ? deque->jobs[--deque->tail] : deque->jobs[deque->head++];
+    qoi_mutex_unlock(&deque->mutex);
+    return found;
+}
+
+static void *pool_worker(void *arg) {
+    Pool_Thread *thread = arg;
+    size_t job;
+    for (;;) {
+        bool found = deque_take(&thread->deques[thread->index], false, &job);
+        // no job is ever added, so once every deque is seen empty the work is done
+        for (size_t i = 1; !found && i < thread->deque_count; ++i) {
+            found = deque_take(&thread->deques[(thread->index + i) % thread->deque_count], true, &job);
+        }
+        if (!found) break;
+        thread->func(thread->worker, job);
+    }
+
+    return NULL;
+}
+
+// Runs func(worker, job) for every job on up to `thread_count` threads, each with its own
+// `worker_size` slot of `workers`. Jobs are dealt out largest `costs` first so every thread
+// starts with its big images; a thread whose deque runs dry steals the smallest job left in
+// another one. The calling thread works too.
+static void run_jobs(size_t job_count, const uint64_t *costs, size_t thread_count, Job_Func func, void *workers, size_t worker_size) {
+    if (thread_count == 0) thread_count = 1;
+
+    Job_Cost *order = malloc((job_count + 1) * sizeof(Job_Cost));
+    Deque *deques = calloc(thread_count, sizeof(Deque));
+    Pool_Thread *threads = malloc(thread_count * sizeof(Pool_Thread));
+    qoi_thread *handles = malloc(thread_count * sizeof(qoi_thread));
+    assert(order != NULL && deques != NULL && threads != NULL && handles != NULL && "Get MORE RAM!");
+
+    for (size_t i = 0; i < job_count; ++i) order[i] = (Job_Cost){ .cost = costs != NULL ? costs[i] : 0, .job = i };
+    qsort(order, job_count, sizeof(Job_Cost), compare_job_costs);
+
+    for (size_t t = 0; t < thread_count; ++t) {
+        deques[t].jobs = malloc((job_count / thread_count + 1) * sizeof(size_t));
+        assert(deques[t].jobs != NULL && "Get MORE RAM!");
+        qoi_mutex_init(&deques[t].mutex);
+        threads[t] = (Pool_Thread){ .deques = deques, .deque_count = thread_count, .index = t, .worker = (char *)workers + t * worker_size, .func = func };
+    }
+    for (size_t i = 0; i < job_count; ++i) {
+        Deque *deque = &deques[i % thread_count];
+        deque->jobs[deque->tail++] = order[i].job;
+    }
+
+    // deques of threads that couldn't be started are drained by stealing
+    bool *started = calloc(thread_count, sizeof(bool));
+    assert(started != NULL && "Get MORE RAM!");
+    for (size_t t = 1; t < thread_count; ++t) started[t] = qoi_thread_create(&handles[t], pool_worker, &threads[t]);
+    pool_worker(&threads[0]);
+    for (size_t t = 1; t < thread_count; ++t) {
+        if (started[t]) qoi_thread_join(handles[t]);
+    }
+
+    for (size_t t = 0; t < thread_count; ++t) {
+        qoi_mutex_destroy(&deques[t].mutex);
+        free(deques[t].jobs);
+    }
+    free(started);
+    free(handles);
+    free(threads);
+    free(deques);
+    free(order);
+}
+
+static double now(void) {
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / frequency.QuadPart;
+#else
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+#endif
+}
+
+// Bounded FIFO handing items from one pipeline stage to the next. push blocks while it's full
+// and pop while it's empty, so a slow stage holds back the ones feeding it instead of letting
+// them pile up memory. Depth and waiting times are kept for the end of run report.
+typedef struct {
+    void    **items;
+    size_t    capacity;
+    size_t    head;
+    size_t    count;
+    bool      closed;
+    qoi_mutex mutex;
+    qoi_cond  not_empty;
+    qoi_cond  not_full;
+
+    size_t    max_depth;
+    size_t    pushes;
+    double    depth_sum;  // depth after every push, for the average
+    double    full_wait;  // seconds producers spent blocked
+    double    empty_wait; // seconds consumers spent blocked
+} Queue;
+
+BATCH_UNUSED static void queue_init(Queue *queue, size_t capacity) {
+    memset(queue, 0, sizeof(*queue));
+    queue->capacity = capacity > 0 ? capacity : 1;
+    queue->items = malloc(queue->capacity * sizeof(void *));
+    assert(queue->items != NULL && "Get MORE RAM!");
+    qoi_mutex_init(&queue->mutex);
+    qoi_cond_init(&queue->not_empty);
+    qoi_cond_init(&queue->not_full);
+}
+
+BATCH_UNUSED static void queue_push(Queue *queue, void *item) {
+    qoi_mutex_lock(&queue->mutex);
+    if (queue->count == queue->capacity) {
+        double start = now();
+        while (queue->count == queue->capacity) qoi_cond_wait(&queue->not_full, &queue->mutex);
+        queue->full_wait += now() - start;
+    }
+
+    queue->items[(queue->head + queue->count) % queue->capacity] = item;
+    queue->count += 1;
+    queue->pushes += 1;
+    queue->depth_sum += queue->count;
+    if (queue->count > queue->max_depth) queue->max_depth = queue->count;
+
+    qoi_cond_signal(&queue->not_empty);
+    qoi_mutex_unlock(&queue->mutex);
+}
+
+// Returns NULL once the queue is closed and drained.
+BATCH_UNUSED static void *queue_pop(Queue *queue) {
+    qoi_mutex_lock(&queue->mutex);
+    if (queue->count == 0 && !queue->closed) {
+        double start = now();
+        while (queue->count == 0 && !queue->closed) qoi_cond_wait(&queue->not_empty, &queue->mutex);
+        queue->empty_wait += now() - start;
+    }
+
+    void *item = NULL;
+    if (queue->count > 0) {
+        item = queue->items[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count -= 1;
+        qoi_cond_signal(&queue->not_full);
+    }
+
+    qoi_mutex_unlock(&queue->mutex);
+    return item;
+}
+
+// Wakes every consumer; they drain what's left and then get NULL.
+BATCH_UNUSED static void queue_close(Queue *queue) {
+    qoi_mutex_lock(&queue->mutex);
+    queue->closed = true;
+    qoi_cond_broadcast(&queue->not_empty);
+    qoi_mutex_unlock(&queue->mutex);
+}
+
+BATCH_UNUSED static void queue_destroy(Queue *queue) {
+    qoi_cond_destroy(&queue->not_full);
+    qoi_cond_destroy(&queue->not_empty);
+    qoi_mutex_destroy(&queue->mutex);
+    free(queue->items);
+}
+
+#endif // BATCH_H_
@@ -5,17 +5,331 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "../thirdparty/stb_image.h"
 
+#include "batch.h"
+
+typedef struct {
+    qoi_ctx      ctx; // file and encode buffers reused from image to image
+    const Paths *inputs;
+    char       **outputs;
+    int         *results;
+} Worker;
+
+typedef struct {
+    size_t  job;
+    int     result;   // exit code so far, later stages skip failed images
+    qoi_ctx ctx;      // the png file in ctx.input and the qoi one in ctx.encoded, reused
+    void   *pixels;   // decoded by stb_image, freed once encoded
+    int     width;
+    int     height;
+    int     channels;
+} Item;
+
+typedef struct Pipeline Pipeline;
+
+typedef struct {
+    const char *name;
+    int       (*process)(Pipeline *pipeline, Item *item);
+    Queue      *input;  // NULL for the read stage, which starts the jobs
+    Queue      *output;
+    Pipeline   *pipeline;
+    size_t      thread_count;
+    size_t      running;
+    size_t      items;
+    double      busy;   // seconds spent processing, summed over the threads
+    qoi_mutex   mutex;
+} Stage;
+
+typedef enum {
+    STAGE_READ,
+    STAGE_DECODE,
+    STAGE_ENCODE,
+    STAGE_WRITE,
+    STAGE_COUNT,
+} Stage_Kind;
+
+struct Pipeline {
+    const Paths *inputs;
+    char       **outputs;
+    int         *results;
+    size_t       next_job; // guarded by the read stage mutex
+    Queue        free;     // items written out and ready for the next read
+    Queue        queues[STAGE_COUNT - 1]; // queues[i] feeds stages[i + 1]
+    Stage        stages[STAGE_COUNT];
+};
+
 void usage(FILE *stream)
 {
-    fprintf(stream, "Usage: ./png_to_qoi [OPTIONS]\n");
+    fprintf(stream, "Usage: ./png_to_qoi [OPTIONS] [<png files, directories or globs...>]\n");
     fprintf(stream, "OPTIONS:\n");
     flag_print_options(stream);
 }
 
+void *load_png(const qoi_bytes *file, const char *input_file, int *w, int *h, int *channels) {
+    int comp;
+    if (!stbi_info_from_memory(file->items, (int)file->count, w, h, &comp)) {
+        fprintf(stderr, "ERROR: Could not read %s: %s\n", input_file, stbi_failure_reason());
+        return NULL;
+    }
+
+    // images without alpha are encoded straight from packed RGB
+    *channels = comp == 2 || comp == 4 ? 4 : 3;
+    void *data = stbi_load_from_memory(file->items, (int)file->count, w, h, &comp, *channels);
+    if (data == NULL) {
+        fprintf(stderr, "ERROR: Could not load %s: %s\n", input_file, stbi_failure_reason());
+    }
+    return data;
+}
+
+int convert(qoi_ctx *ctx, const char *input_file, const char *output_file) {
+    if (!qoi_ctx_read_file(ctx, input_file)) {
+        return 2;
+    }
+
+    int w, h, channels;
+    void *data = load_png(&ctx->input, input_file, &w, &h, &channels);
+    if (data == NULL) {
+        return 2;
+    }
+
+    bool written = qoi_ctx_write_image_layout(ctx, output_file, w, h, 1, data, channels == 3 ? QOI_LAYOUT_RGB : QOI_LAYOUT_RGBA, channels == 3);
+    stbi_image_free(data);
+    return written ? 0 : 3;
+}
+
+void convert_job(void *arg, size_t job) {
+    Worker *worker = arg;
+    worker->results[job] = convert(&worker->ctx, worker->inputs->items[job], worker->outputs[job]);
+}
+
+void convert_pooled(const Paths *inputs, char **outputs, const uint64_t *costs, int *results, size_t threads) {
+    size_t thread_count = threads == 0 ? qoi_cpu_count() : threads;
+    if (thread_count > inputs->count) thread_count = inputs->count > 0 ? inputs->count : 1;
+    Worker *workers = calloc(thread_count, sizeof(Worker));
+    assert(workers != NULL && "Get MORE RAM!");
+    for (size_t t = 0; t < thread_count; ++t) {
+        workers[t] = (Worker){ .inputs = inputs, .outputs = outputs, .results = results };
+    }
+
+    run_jobs(inputs->count, costs, thread_count, convert_job, workers, sizeof(Worker));
+
+    for (size_t t = 0; t < thread_count; ++t) qoi_ctx_free(&workers[t].ctx);
+    free(workers);
+}
+
+int read_stage(Pipeline *pipeline, Item *item) {
+    return qoi_ctx_read_file(&item->ctx, pipeline->inputs->items[item->job]) ? 0 : 2;
+}
+
+int decode_stage(Pipeline *pipeline, Item *item) {
+    item->pixels = load_png(&item->ctx.input, pipeline->inputs->items[item->job], &item->width, &item->height, &item->channels);
+    return item->pixels != NULL ? 0 : 2;
+}
+
+int encode_stage(Pipeline *pipeline, Item *item) {
+    (void)pipeline;
+    item->ctx.encoded.count = 0;
+    bool opaque = item->channels == 3;
+    bool encoded = qoi_encode_to_bytes_layout(&item->ctx.encoded, item->width, item->height, 1, item->pixels, opaque ? QOI_LAYOUT_RGB : QOI_LAYOUT_RGBA, opaque);
+    stbi_image_free(item->pixels);
+    item->pixels = NULL;
+    return encoded ? 0 : 3;
+}
+
+int write_stage(Pipeline *pipeline, Item *item) {
+    return qoi_ctx_write_file(&item->ctx, pipeline->outputs[item->job]) ? 0 : 3;
+}
+
+void *stage_main(void *arg) {
+    Stage *stage = arg;
+    Pipeline *pipeline = stage->pipeline;
+    for (;;) {
+        Item *item;
+        if (stage->input != NULL) {
+            item = queue_pop(stage->input);
+            if (item == NULL) break;
+        }
+        else {
+            qoi_mutex_lock(&stage->mutex);
+            size_t job = pipeline->next_job < pipeline->inputs->count ? pipeline->next_job++ : SIZE_MAX;
+            qoi_mutex_unlock(&stage->mutex);
+            if (job == SIZE_MAX) break;
+
+            item = queue_pop(&pipeline->free);
+            item->job = job;
+            item->result = 0;
+        }
+
+        double start = now();
+        if (item->result == 0) item->result = stage->process(pipeline, item);
+        double busy = now() - start;
+        pipeline->results[item->job] = item->result;
+
+        qoi_mutex_lock(&stage->mutex);
+        stage->busy += busy;
+        stage->items += 1;
+        qoi_mutex_unlock(&stage->mutex);
+
+        queue_push(stage->output, item);
+    }
+
+    // the last thread out lets the next stage know nothing else is coming
+    qoi_mutex_lock(&stage->mutex);
+    bool last = --stage->running == 0;
+    qoi_mutex_unlock(&stage->mutex);
+    if (last) queue_close(stage->output);
+    return NULL;
+}
+
+void print_pipeline_stats(const Pipeline *pipeline, double wall) {
+    printf("%-8s %8s %8s %10s %12s\n", "stage", "threads", "images", "busy s", "utilization");
+    for (size_t i = 0; i < STAGE_COUNT; ++i) {
+        const Stage *stage = &pipeline->stages[i];
+        double utilization = wall > 0 ? stage->busy / (wall * stage->thread_count) * 100 : 0;
+        printf("%-8s %8zu %8zu %10.3f %11.1f%%\n", stage->name, stage->thread_count, stage->items, stage->busy, utilization);
+    }
+
+    printf("%-16s %9s %10s %10s %12s %12s\n", "queue", "capacity", "max depth", "avg depth", "full wait s", "empty wait s");
+    for (size_t i = 0; i < STAGE_COUNT; ++i) {
+        // the free item queue closes the loop from the write stage back to the read stage
+        const Queue *queue = i < STAGE_COUNT - 1 ? &pipeline->queues[i] : &pipeline->free;
+        char name[32];
+        snprintf(name, sizeof(name), "%s->%s", pipeline->stages[i].name, pipeline->stages[(i + 1) % STAGE_COUNT].name);
+        printf("%-16s %9zu %10zu %10.1f %12.3f %12.3f\n", name, queue->capacity, queue->max_depth,
+               queue->pushes > 0 ? queue->depth_sum / queue->pushes : 0, queue->full_wait, queue->empty_wait);
+    }
+}
+
+// Runs every conversion through read, decode, encode and write stages connected by bounded
+// queues. The I/O stages get `io_threads` each and the compute stages `threads` each, so a
+// slow disk is read and written while other images are being encoded. Items (and their
+// buffers) cycle from the write stage back to the read stage, which caps the memory in flight.
+void convert_pipelined(const Paths *inputs, char **outputs, const uint64_t *costs, int *results, size_t threads, size_t io_threads, size_t queue_depth) {
+    size_t compute_threads = threads == 0 ? qoi_cpu_count() : threads;
+    if (io_threads == 0) io_threads = 1;
+    if (queue_depth == 0) queue_depth = 1;
+
+    Pipeline pipeline = { .inputs = inputs, .outputs = outputs, .results = results };
+    static const char *names[STAGE_COUNT] = { "read", "decode", "encode", "write" };
+    int (*processes[STAGE_COUNT])(Pipeline *, Item *) = { read_stage, decode_stage, encode_stage, write_stage };
+
+    size_t item_count = (STAGE_COUNT - 1) * queue_depth;
+    for (size_t i = 0; i < STAGE_COUNT - 1; ++i) queue_init(&pipeline.queues[i], queue_depth);
+    for (size_t i = 0; i < STAGE_COUNT; ++i) {
+        Stage *stage = &pipeline.stages[i];
+        stage->name = names[i];
+        stage->process = processes[i];
+        stage->input = i > 0 ? &pipeline.queues[i - 1] : NULL;
+        stage->output = i < STAGE_COUNT - 1 ? &pipeline.queues[i] : &pipeline.free;
+        stage->pipeline = &pipeline;
+        stage->thread_count = i == STAGE_READ || i == STAGE_WRITE ? io_threads : compute_threads;
+        stage->running = stage->thread_count;
+        qoi_mutex_init(&stage->mutex);
+        item_count += stage->thread_count;
+    }
+
+    Item *items = calloc(item_count, sizeof(Item));
+    assert(items != NULL && "Get MORE RAM!");
+    queue_init(&pipeline.free, item_count);
+    for (size_t i = 0; i < item_count; ++i) queue_push(&pipeline.free, &items[i]);
+    pipeline.free.max_depth = pipeline.free.pushes = 0;
+    pipeline.free.depth_sum = 0;
+
+    size_t thread_total = 0;
+    for (size_t i = 0; i < STAGE_COUNT; ++i) thread_total += pipeline.stages[i].thread_count;
+    qoi_thread *handles = malloc(thread_total * sizeof(qoi_thread));
+    bool *started = calloc(thread_total, sizeof(bool));
+    assert(handles != NULL && started != NULL && "Get MORE RAM!");
+
+    double start = now();
+    // downstream stages start first; when one of them gets no thread at all the stages already
+    // running are shut down and the images are converted on the pool instead. The calling
+    // thread is one of the readers, so the read stage always runs.
+    bool complete = true;
+    size_t handle = thread_total;
+    for (size_t i = STAGE_COUNT; complete && i-- > 0;) {
+        Stage *stage = &pipeline.stages[i];
+        size_t first = i == STAGE_READ ? 1 : 0;
+        for (size_t t = first; t < stage->thread_count; ++t) {
+            handle -= 1;
+            started[handle] = qoi_thread_create(&handles[handle], stage_main, stage);
+            if (!started[handle]) stage->running -= 1;
+        }
+        if (stage->running == 0) {
+            fprintf(stderr, "ERROR: Could not start the %s stage, converting without the pipeline\n", stage->name);
+            queue_close(stage->output);
+            complete = false;
+        }
+    }
+    if (complete) stage_main(&pipeline.stages[STAGE_READ]);
+    for (size_t i = 0; i < thread_total; ++i) {
+        if (started[i]) qoi_thread_join(handles[i]);
+    }
+    double wall = now() - start;
+
+    if (!complete) convert_pooled(inputs, outputs, costs, results, 1);
+    else print_pipeline_stats(&pipeline, wall);
+
+    for (size_t i = 0; i < item_count; ++i) qoi_ctx_free(&items[i].ctx);
+    for (size_t i = 0; i < STAGE_COUNT; ++i) qoi_mutex_destroy(&pipeline.stages[i].mutex);
+    for (size_t i = 0; i < STAGE_COUNT - 1; ++i) queue_destroy(&pipeline.queues[i]);
+    queue_destroy(&pipeline.free);
+    free(started);
+    free(handles);
+    free(items);
+}
+
+// Converts every input on a work-stealing pool, biggest files first, or through the staged
+// pipeline. Returns the exit code of the first input that failed.
+int convert_batch(const char *list_file, const char *output_dir, size_t threads, bool pipelined, size_t io_threads, size_t queue_depth) {
+    int result = 0;
+    Paths inputs = {0};
+    if (list_file != NULL && !collect_list(list_file, ".png", &inputs)) result = 2;
+    for (int i = 0; i < flag_rest_argc(); ++i) {
+        if (!collect_input(flag_rest_argv()[i], ".png", &inputs)) result = 2;
+    }
+
+    char **outputs = malloc((inputs.count + 1) * sizeof(char *));
+    uint64_t *costs = malloc((inputs.count + 1) * sizeof(uint64_t));
+    int *results = calloc(inputs.count + 1, sizeof(int));
+    assert(outputs != NULL && costs != NULL && results != NULL && "Get MORE RAM!");
+    for (size_t i = 0; i < inputs.count; ++i) outputs[i] = output_path(output_dir, inputs.items[i], ".qoi");
+    if (!unique_outputs(&inputs, outputs)) {
+        result = 1;
+        goto defer;
+    }
+    for (size_t i = 0; i < inputs.count; ++i) costs[i] = file_size(inputs.items[i]);
+
+    double start = now();
+    if (pipelined) convert_pipelined(&inputs, outputs, costs, results, threads, io_threads, queue_depth);
+    else convert_pooled(&inputs, outputs, costs, results, threads);
+    double elapsed = now() - start;
+
+    size_t converted = 0;
+    for (size_t i = 0; i < inputs.count; ++i) {
+        if (results[i] == 0) converted += 1;
+        else if (result == 0) result = results[i];
+    }
+    printf("Converted %zu of %zu images in %.3fs\n", converted, inputs.count, elapsed);
+
+defer:
+    for (size_t i = 0; i < inputs.count; ++i) free(outputs[i]);
+    free(results);
+    free(costs);
+    free(outputs);
+    free_paths(&inputs);
+    return result;
+}
+
 int main(int argc, char **argv) {
     bool *help = flag_bool("help", false, "Print this help to stdout and exit with 0");
-    char **input_file = flag_str("input-image", NULL, "Input png image path to convert to qoi (MANDATORY)");
-    char **output_file = flag_str("output-image", NULL, "Output qoi image path (MANDATORY)");
+    char **input_file = flag_str("input-image", NULL, "Input png image path to convert to qoi (single image mode)");
+    char **output_file = flag_str("output-image", NULL, "Output qoi image path (single image mode)");
+    char **list_file = flag_str("list", NULL, "File listing the images to convert, one per line (batch mode)");
+    char **output_dir = flag_str("output-dir", NULL, "Directory the batch outputs go to (next to the inputs by default)");
+    size_t *threads = flag_size("j", 0, "Images converted at once in batch mode (0 uses every core)");
+    bool *pipelined = flag_bool("pipeline", false, "Convert the batch in separate read, decode, encode and write stages and report them");
+    size_t *io_threads = flag_size("io-threads", 2, "Threads reading and threads writing files with -pipeline");
+    size_t *queue_depth = flag_size("queue-depth", 4, "Images waiting between two stages with -pipeline");
 
     if (!flag_parse(argc, argv)) {
         usage(stderr);
@@ -28,6 +342,15 @@ int main(int argc, char **argv) {
         exit(0);
     }
 
+    if (*list_file != NULL || flag_rest_argc() > 0) {
+        if (*input_file != NULL || *output_file != NULL) {
+            usage(stderr);
+            fprintf(stderr, "ERROR: -%s and -%s convert a single image and can't be used with a batch\n", flag_name(input_file), flag_name(output_file));
+            return 1;
+        }
+        return convert_batch(*list_file, *output_dir, *threads, *pipelined, *io_threads, *queue_depth);
+    }
+
     if (*input_file == NULL) {
         usage(stderr);
         fprintf(stderr, "ERROR: No -%s was provided\n", flag_name(input_file));
@@ -39,16 +362,8 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    int w, h, comp;
-    void *data = stbi_load(*input_file, &w, &h, &comp, 4);
-    if (data == NULL) {
-        return 2;
-    }
-
-    if(!qoi_write_image(*output_file, w, h, comp, 1, data)) {
-        return 3;
-    }
-
-    stbi_image_free(data);
-    return 0;
+    qoi_ctx ctx = {0};
+    int result = convert(&ctx, *input_file, *output_file);
+    qoi_ctx_free(&ctx);
+    return result;
 }
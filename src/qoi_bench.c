@@ -0,0 +1,210 @@
+#define QOI_IMPLEMENTATION
+#include "../qoi.h"
+#define FLAG_IMPLEMENTATION
+#include "../thirdparty/flag.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+typedef struct {
+    const char *name;
+    qoi_layout  layout;
+    bool        opaque;
+} Variant;
+
+// One entry per specialized core; the `x` variants are encoded as known opaque
+static const Variant variants[] = {
+    { "rgba", QOI_LAYOUT_RGBA, false },
+    { "rgbx", QOI_LAYOUT_RGBA, true  },
+    { "rgb",  QOI_LAYOUT_RGB,  true  },
+    { "bgra", QOI_LAYOUT_BGRA, false },
+    { "bgrx", QOI_LAYOUT_BGRA, true  },
+    { "argb", QOI_LAYOUT_ARGB, false },
+    { "xrgb", QOI_LAYOUT_ARGB, true  },
+};
+#define VARIANT_COUNT (sizeof(variants) / sizeof(variants[0]))
+
+void usage(FILE *stream)
+{
+    fprintf(stream, "Usage: ./qoi_bench [OPTIONS] <QOI image paths...>\n");
+    fprintf(stream, "OPTIONS:\n");
+    flag_print_options(stream);
+}
+
+double now(void) {
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / frequency.QuadPart;
+#else
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+#endif
+}
+
+bool read_file(const char *path, qoi_bytes *bytes) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "ERROR: Could not open %s\n", path);
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (size < 0) {
+        fprintf(stderr, "ERROR: Could not read %s\n", path);
+        fclose(file);
+        return false;
+    }
+
+    qoi_da_reserve(bytes, (size_t)size);
+    bytes->count = fread(bytes->items, 1, size, file);
+
+    fclose(file);
+    return true;
+}
+
+// Decodes into and encodes from every layout on the calling thread; the opaque variants encode on
+// the core without alpha checks. Built with QOI_GENERIC_ONLY (build/qoi_bench_generic) the same
+// runs go through the generic conversion path and the RGBA core instead.
+bool bench_layouts(const char *path, const qoi_bytes *file, size_t reps, double totals[VARIANT_COUNT][3]) {
+    qoi_header header;
+    if (!qoi_decode_header(file->items, file->count, &header)) {
+        fprintf(stderr, "ERROR: Could not decode %s\n", path);
+        return false;
+    }
+
+    double pixels = (double)header.width * header.height;
+    size_t capacity = qoi_max_encoded_size(header.width, header.height, 4);
+    uint8_t *encoded = QOI_Malloc(capacity);
+    uint8_t *decoded = QOI_Malloc((size_t)header.width * header.height * 4);
+    assert(encoded != NULL && decoded != NULL && "Get MORE RAM!");
+
+    for (size_t i = 0; i < VARIANT_COUNT; ++i) {
+        size_t stride = (size_t)header.width * (variants[i].layout == QOI_LAYOUT_RGB ? 3 : 4);
+        size_t pixels_size = stride * header.height;
+
+        double start = now();
+        for (size_t rep = 0; rep < reps; ++rep) {
+            if (!qoi_decode_into(file->items, file->count, &header, decoded, pixels_size, stride, variants[i].layout)) return false;
+        }
+        double decode = now() - start;
+
+        start = now();
+        for (size_t rep = 0; rep < reps; ++rep) {
+            if (0 == qoi_encode_layout(encoded, capacity, header.width, header.height, header.colorspace, decoded, variants[i].layout, variants[i].opaque)) return false;
+        }
+        double encode = now() - start;
+
+        printf("%-32s %-8s %12.1f %12.1f\n", path, variants[i].name, pixels * reps / decode / 1e6, pixels * reps / encode / 1e6);
+        totals[i][0] += pixels * reps;
+        totals[i][1] += decode;
+        totals[i][2] += encode;
+    }
+
+    QOI_Free(decoded);
+    QOI_Free(encoded);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    bool *help = flag_bool("help", false, "Print this help to stdout and exit with 0");
+    size_t *reps = flag_size("reps", 20, "Number of times each image is decoded and encoded");
+    size_t *threads = flag_size("threads", 1, "Threads used to decode and encode (0 uses every core)");
+    bool *layouts = flag_bool("layouts", false, "Benchmark decoding into and encoding from every pixel layout on one thread");
+
+    if (!flag_parse(argc, argv)) {
+        usage(stderr);
+        flag_print_error(stderr);
+        return 1;
+    }
+
+    if (*help) {
+        usage(stdout);
+        exit(0);
+    }
+
+    int file_count = flag_rest_argc();
+    char **files = flag_rest_argv();
+    if (file_count == 0) {
+        usage(stderr);
+        fprintf(stderr, "ERROR: No input images were provided\n");
+        return 1;
+    }
+    if (*reps == 0) *reps = 1;
+    printf("simd: %s\n", qoi_simd_name(qoi_simd()));
+#ifdef QOI_NO_COMPUTED_GOTO
+    printf("dispatch: switch\n");
+#else
+    printf("dispatch: computed goto\n");
+#endif
+
+    if (*layouts) {
+        double totals[VARIANT_COUNT][3] = {0};
+#ifdef QOI_GENERIC_ONLY
+        printf("generic path\n");
+#endif
+        printf("%-32s %-8s %12s %12s\n", "image", "layout", "decode MP/s", "encode MP/s");
+        for (int i = 0; i < file_count; ++i) {
+            qoi_bytes file = {0};
+            if (!read_file(files[i], &file)) return 2;
+            if (!bench_layouts(files[i], &file, *reps, totals)) return 2;
+            qoi_free_bytes(&file);
+        }
+        for (size_t i = 0; i < VARIANT_COUNT; ++i) {
+            printf("%-32s %-8s %12.1f %12.1f\n", "total", variants[i].name, totals[i][0] / totals[i][1] / 1e6, totals[i][0] / totals[i][2] / 1e6);
+        }
+        return 0;
+    }
+
+    double total_pixels = 0, total_decode = 0, total_encode = 0;
+    printf("%-32s %10s %12s %12s\n", "image", "pixels", "decode MP/s", "encode MP/s");
+
+    for (int i = 0; i < file_count; ++i) {
+        qoi_bytes file = {0};
+        if (!read_file(files[i], &file)) return 2;
+
+        qoi_image image = {0};
+        if (!qoi_decode(file.items, file.count, &image)) {
+            fprintf(stderr, "ERROR: Could not decode %s\n", files[i]);
+            return 2;
+        }
+
+        double pixels = (double)image.header.width * image.header.height;
+        size_t capacity = qoi_max_encoded_size(image.header.width, image.header.height, image.header.channels);
+        uint8_t *encoded = QOI_Malloc(capacity);
+        assert(encoded != NULL && "Get MORE RAM!");
+
+        double start = now();
+        for (size_t rep = 0; rep < *reps; ++rep) {
+            qoi_image decoded = {0};
+            if (!qoi_decode_parallel(file.items, file.count, &decoded, *threads)) return 2;
+            qoi_free_image(&decoded);
+        }
+        double decode = now() - start;
+
+        start = now();
+        for (size_t rep = 0; rep < *reps; ++rep) {
+            if (0 == qoi_encode_parallel(encoded, capacity, image.header.width, image.header.height, image.header.channels, image.header.colorspace, image.image_data.items, *threads)) return 3;
+        }
+        double encode = now() - start;
+
+        printf("%-32s %10.0f %12.1f %12.1f\n", files[i], pixels, pixels * *reps / decode / 1e6, pixels * *reps / encode / 1e6);
+        total_pixels += pixels * *reps;
+        total_decode += decode;
+        total_encode += encode;
+
+        QOI_Free(encoded);
+        qoi_free_image(&image);
+        qoi_free_bytes(&file);
+    }
+
+    printf("%-32s %10s %12.1f %12.1f\n", "total", "", total_pixels / total_decode / 1e6, total_pixels / total_encode / 1e6);
+    return 0;
+}
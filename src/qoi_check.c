@@ -0,0 +1,955 @@
+#include <math.h>
+
+#define QOI_IMPLEMENTATION
+#include "../qoi.h"
+#define FLAG_IMPLEMENTATION
+#include "../thirdparty/flag.h"
+
+#define BLACK { 0, 0, 0, 255 }
+#define RED   { 255, 0, 0, 255 }
+
+// 62 pixels equal to the initial previous pixel end their RUN exactly on a multiple of 62; the
+// RUN pixel must still go to the index so the last pixel is an INDEX op (35), not a DIFF.
+static const uint8_t run_62_expected[] = {
+    'q', 'o', 'i', 'f', 0, 0, 0, 64, 0, 0, 0, 1, 4, 0,
+    0xfd, 0x5a, 0x35,
+    0, 0, 0, 0, 0, 0, 0, 1,
+};
+
+void usage(FILE *stream)
+{
+    fprintf(stream, "Usage: ./qoi_check [OPTIONS] [<QOI image paths...>]\n");
+    fprintf(stream, "OPTIONS:\n");
+    flag_print_options(stream);
+}
+
+// Encodes the pixels serially and in parallel with every thread count up to `threads`, and
+// fails on the first output that isn't identical to the serial one.
+bool check_parallel(const char *name, uint32_t width, uint32_t height, const qoi_rgba *pixels, uint32_t threads) {
+    size_t capacity = qoi_max_encoded_size(width, height, 4);
+    uint8_t *serial = QOI_Malloc(capacity);
+    uint8_t *parallel = QOI_Malloc(capacity);
+    assert(serial != NULL && parallel != NULL && "Get MORE RAM!");
+
+    bool result = true;
+    size_t serial_size = qoi_encode(serial, capacity, width, height, 4, 0, pixels);
+    for (uint32_t t = 1; result && t <= threads; ++t) {
+        size_t parallel_size = qoi_encode_parallel(parallel, capacity, width, height, 4, 0, pixels, t);
+        if (serial_size == 0 || parallel_size != serial_size || memcmp(serial, parallel, serial_size) != 0) {
+            fprintf(stderr, "ERROR: %s: parallel output with %u threads differs from qoi_encode\n", name, t);
+            result = false;
+        }
+    }
+
+    QOI_Free(parallel);
+    QOI_Free(serial);
+    return result;
+}
+
+bool check_run_62(void) {
+    qoi_rgba pixels[64];
+    for (size_t i = 0; i < 62; ++i) pixels[i] = (qoi_rgba)BLACK;
+    pixels[62] = (qoi_rgba)RED;
+    pixels[63] = (qoi_rgba)BLACK;
+
+    uint8_t encoded[sizeof(run_62_expected) + 64];
+    size_t size = qoi_encode(encoded, sizeof(encoded), 64, 1, 4, 0, pixels);
+    if (size != sizeof(run_62_expected) || memcmp(encoded, run_62_expected, size) != 0) {
+        fprintf(stderr, "ERROR: run-62: qoi_encode output differs from the reference encoder\n");
+        return false;
+    }
+
+    return check_parallel("run-62", 64, 1, pixels, 1);
+}
+
+// The same pattern tiled over an image big enough to be split into stripes, with periods that
+// put the stripe boundaries both inside and at the end of RUNs of 62.
+bool check_run_62_stripes(uint32_t threads) {
+    uint32_t width = 1024, height = 1024;
+    qoi_rgba *pixels = QOI_Malloc((size_t)width * height * sizeof(qoi_rgba));
+    assert(pixels != NULL && "Get MORE RAM!");
+
+    bool result = true;
+    static const size_t periods[] = { 63, 64, 124, 125 };
+    for (size_t p = 0; result && p < sizeof(periods) / sizeof(periods[0]); ++p) {
+        for (size_t i = 0; i < (size_t)width * height; ++i) {
+            pixels[i] = i % periods[p] == 62 ? (qoi_rgba)RED : (qoi_rgba)BLACK;
+        }
+
+        char name[32];
+        snprintf(name, sizeof(name), "run-62 period %zu", periods[p]);
+        result = check_parallel(name, width, height, pixels, threads);
+    }
+
+    QOI_Free(pixels);
+    return result;
+}
+
+// xorshift64*, so every run with the same -seed checks the same images and streams
+static uint64_t rng_state = 1;
+
+uint32_t rng(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (uint32_t)((rng_state * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+// The library explains every input it rejects on stderr; the checks feed it thousands of them on
+// purpose, so its stderr goes to the null device around those calls.
+static int saved_stderr = -1;
+
+void quiet_stderr(bool quiet) {
+    fflush(stderr);
+#ifndef _WIN32
+    if (quiet) {
+        saved_stderr = dup(2);
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, 2);
+        close(null);
+    }
+    else {
+        dup2(saved_stderr, 2);
+        close(saved_stderr);
+    }
+#else
+    if (quiet) {
+        saved_stderr = _dup(2);
+        int null = _open("NUL", _O_WRONLY);
+        _dup2(null, 2);
+        _close(null);
+    }
+    else {
+        _dup2(saved_stderr, 2);
+        _close(saved_stderr);
+    }
+#endif
+}
+
+uint8_t ref_hash(qoi_rgba px) {
+    return (px.r * 3 + px.g * 5 + px.b * 7 + px.a * 11) % 64;
+}
+
+uint32_t ref_read_u32be(const uint8_t *in) {
+    return (uint32_t)in[0] << 24 | (uint32_t)in[1] << 16 | (uint32_t)in[2] << 8 | in[3];
+}
+
+void ref_write_u32be(uint8_t *out, uint32_t v) {
+    out[0] = v >> 24;
+    out[1] = v >> 16;
+    out[2] = v >> 8;
+    out[3] = v;
+}
+
+void ref_write_header(uint8_t *out, uint32_t width, uint32_t height, uint8_t channels, uint8_t colorspace) {
+    memcpy(out, QOI_MAGIC, 4);
+    ref_write_u32be(out + 4, width);
+    ref_write_u32be(out + 8, height);
+    out[12] = channels;
+    out[13] = colorspace;
+}
+
+// The encoder written straight from the format description, one pixel at a time, that every
+// optimized encode path is compared with. Like qoi_encode, every RUN pixel also goes to the index.
+// `out` needs room for qoi_max_encoded_size bytes.
+size_t ref_encode(uint8_t *out, uint32_t width, uint32_t height, uint8_t channels, uint8_t colorspace, const qoi_rgba *pixels) {
+    uint8_t *start = out;
+    ref_write_header(out, width, height, channels, colorspace);
+    out += QOI_HEADER_SIZE;
+
+    qoi_rgba index[64] = {0};
+    qoi_rgba prev = { 0, 0, 0, 255 };
+    uint32_t run = 0;
+    for (size_t i = 0; i < (size_t)width * height; ++i) {
+        qoi_rgba px = pixels[i];
+        uint8_t hash = ref_hash(px);
+        if (memcmp(&px, &prev, sizeof(px)) == 0) {
+            index[hash] = px;
+            if (++run == 62) {
+                *out++ = RUN | 61;
+                run = 0;
+            }
+            continue;
+        }
+        if (run > 0) {
+            *out++ = RUN | (run - 1);
+            run = 0;
+        }
+
+        int8_t dr = px.r - prev.r, dg = px.g - prev.g, db = px.b - prev.b;
+        if (memcmp(&index[hash], &px, sizeof(px)) == 0) {
+            *out++ = INDEX | hash;
+        }
+        else if (px.a != prev.a) {
+            *out++ = RGBA;
+            *out++ = px.r;
+            *out++ = px.g;
+            *out++ = px.b;
+            *out++ = px.a;
+        }
+        else if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+            *out++ = DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+        }
+        else if (dg >= -32 && dg <= 31 && dr - dg >= -8 && dr - dg <= 7 && db - dg >= -8 && db - dg <= 7) {
+            *out++ = LUMA | (dg + 32);
+            *out++ = (dr - dg + 8) << 4 | (db - dg + 8);
+        }
+        else {
+            *out++ = RGB;
+            *out++ = px.r;
+            *out++ = px.g;
+            *out++ = px.b;
+        }
+        index[hash] = px;
+        prev = px;
+    }
+    if (run > 0) *out++ = RUN | (run - 1);
+
+    memcpy(out, QOI_END, QOI_END_SIZE);
+    return out + QOI_END_SIZE - start;
+}
+
+// The matching decoder: decodes the ops in `ops` into at most `count` pixels, stopping at an op cut
+// off by the end, and returns how many it decoded. Like every decoder of the library, it starts with
+// the pixel before the first one (opaque black) in the index. `exact` tells whether the ops hold
+// exactly `count` pixels, with no op left over or cut off.
+size_t ref_decode(const uint8_t *ops, size_t ops_size, qoi_rgba *pixels, size_t count, bool *exact) {
+    const uint8_t *ops_end = ops + ops_size;
+    qoi_rgba index[64] = {0};
+    qoi_rgba px = { 0, 0, 0, 255 };
+    index[ref_hash(px)] = px;
+
+    size_t decoded = 0;
+    uint64_t total = 0;
+    while (ops < ops_end) {
+        size_t op_size = *ops == RGBA ? 5 : *ops == RGB ? 4 : (*ops & 0b11000000) == LUMA ? 2 : 1;
+        if ((size_t)(ops_end - ops) < op_size) break;
+
+        uint32_t run = 1;
+        if (*ops == RGBA) {
+            px = (qoi_rgba){ ops[1], ops[2], ops[3], ops[4] };
+        }
+        else if (*ops == RGB) {
+            px = (qoi_rgba){ ops[1], ops[2], ops[3], px.a };
+        }
+        else if ((*ops & 0b11000000) == INDEX) {
+            px = index[*ops];
+        }
+        else if ((*ops & 0b11000000) == DIFF) {
+            px.r += ((*ops >> 4) & 3) - 2;
+            px.g += ((*ops >> 2) & 3) - 2;
+            px.b += (*ops & 3) - 2;
+        }
+        else if ((*ops & 0b11000000) == LUMA) {
+            int dg = (ops[0] & 0b00111111) - 32;
+            px.r += dg + (ops[1] >> 4) - 8;
+            px.g += dg;
+            px.b += dg + (ops[1] & 0b00001111) - 8;
+        }
+        else {
+            run = (*ops & 0b00111111) + 1;
+        }
+        ops += op_size;
+
+        index[ref_hash(px)] = px;
+        for (; run > 0; --run, ++total) {
+            if (decoded < count) pixels[decoded++] = px;
+        }
+    }
+
+    *exact = ops == ops_end && total == count;
+    return decoded;
+}
+
+// What the reference decoder makes of a whole file.
+typedef struct {
+    qoi_header header;
+    bool       ended; // the end marker is in place, so decoders of parts of the image may accept it
+    bool       fits;  // the ops could hold all pixels, so decoders get a buffer for them
+    bool       valid; // every decoder of whole images has to accept it
+    bool       exact; // qoi_validate has to accept it too
+    bool       indexed;
+    size_t     pixel_count;
+    size_t     decoded; // the pixels the ops hold, at most pixel_count
+    qoi_rgba  *pixels;
+} Reference;
+
+// A trailing seek index is split off first, when what is in front of it can still hold a header and
+// an end marker. No more pixels are allocated than the ops could hold (62 per byte), so mutated
+// headers can't make it allocate much.
+Reference ref_decode_file(const uint8_t *data, size_t size) {
+    Reference ref = {0};
+    if (size < QOI_HEADER_SIZE + QOI_END_SIZE || memcmp(data, QOI_MAGIC, 4) != 0) return ref;
+    if (memcmp(data + size - 4, QOI_INDEX_MAGIC, 4) == 0) {
+        size_t index_size = (size_t)ref_read_u32be(data + size - QOI_INDEX_FOOTER_SIZE) * QOI_CHECKPOINT_SIZE + QOI_INDEX_FOOTER_SIZE;
+        if (index_size + QOI_HEADER_SIZE + QOI_END_SIZE <= size) {
+            size -= index_size;
+            ref.indexed = true;
+        }
+    }
+    if (memcmp(data + size - QOI_END_SIZE, QOI_END, QOI_END_SIZE) != 0) return ref;
+
+    qoi_decode_header(data, size, &ref.header);
+    size_t ops_size = size - QOI_HEADER_SIZE - QOI_END_SIZE;
+    ref.ended = true;
+    ref.pixel_count = (size_t)ref.header.width * ref.header.height;
+    ref.fits = ref.pixel_count <= (uint64_t)ops_size * 62;
+
+    size_t count = ref.fits ? ref.pixel_count : ops_size * 62;
+    ref.pixels = QOI_Malloc(count * sizeof(qoi_rgba) + 1);
+    assert(ref.pixels != NULL && "Get MORE RAM!");
+    ref.decoded = ref_decode(data + QOI_HEADER_SIZE, ops_size, ref.pixels, count, &ref.exact);
+    ref.valid = ref.decoded == ref.pixel_count;
+    ref.exact = ref.exact && ref.valid;
+    return ref;
+}
+
+// 64-bit FNV-1a of the RGBA bytes of the reference pixels, the hash qoi_validate_hash returns.
+uint64_t ref_pixels_hash(const Reference *ref) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < ref->pixel_count; ++i) {
+        const uint8_t bytes[4] = { ref->pixels[i].r, ref->pixels[i].g, ref->pixels[i].b, ref->pixels[i].a };
+        for (size_t b = 0; b < 4; ++b) hash = (hash ^ bytes[b]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+// Whether a decoder's verdict and pixels match the reference.
+bool agrees(bool accepted, const qoi_rgba *pixels, const Reference *ref) {
+    if (accepted != ref->valid) return false;
+    return !accepted || ref->pixel_count == 0 || memcmp(pixels, ref->pixels, ref->pixel_count * sizeof(qoi_rgba)) == 0;
+}
+
+// The same for decoders filling a qoi_image, which also have to give it the right size.
+bool agrees_image(bool accepted, const qoi_image *image, const Reference *ref) {
+    if (accepted && (image->header.width != ref->header.width || image->header.height != ref->header.height || image->image_data.count != ref->pixel_count)) return false;
+    return agrees(accepted, image->image_data.items, ref);
+}
+
+static const qoi_layout layouts[] = { QOI_LAYOUT_RGBA, QOI_LAYOUT_RGB, QOI_LAYOUT_BGRA, QOI_LAYOUT_ARGB };
+static const char *layout_names[] = { "RGBA", "RGB", "BGRA", "ARGB" };
+
+// Stores RGBA pixels in `layout`, `stride` bytes per row (packed rows for 0).
+void ref_store(uint8_t *out, const qoi_rgba *pixels, uint32_t width, uint32_t height, size_t stride, qoi_layout layout) {
+    size_t pixel_size = layout == QOI_LAYOUT_RGB ? 3 : 4;
+    if (stride == 0) stride = (size_t)width * pixel_size;
+    for (uint32_t y = 0; y < height; ++y) {
+        for (uint32_t x = 0; x < width; ++x) {
+            qoi_rgba px = pixels[(size_t)y * width + x];
+            uint8_t *p = out + y * stride + x * pixel_size;
+            switch (layout) {
+            case QOI_LAYOUT_RGBA: p[0] = px.r; p[1] = px.g; p[2] = px.b; p[3] = px.a; break;
+            case QOI_LAYOUT_RGB:  p[0] = px.r; p[1] = px.g; p[2] = px.b;              break;
+            case QOI_LAYOUT_BGRA: p[0] = px.b; p[1] = px.g; p[2] = px.r; p[3] = px.a; break;
+            case QOI_LAYOUT_ARGB: p[0] = px.a; p[1] = px.r; p[2] = px.g; p[3] = px.b; break;
+            }
+        }
+    }
+}
+
+// sRGB to linear straight from the sRGB transfer function, scaled to 0..255.
+double ref_srgb_to_linear(uint8_t c) {
+    double s = c / 255.0;
+    return 255.0 * (s <= 0.04045 ? s / 12.92 : pow((s + 0.055) / 1.055, 2.4));
+}
+
+// The conversions of qoi_decode_into_converted: linear color channels rounded to 8 bits (unless the
+// header says they are linear already), then premultiplied by alpha with rounding.
+void ref_convert(qoi_rgba *out, const qoi_rgba *pixels, size_t count, uint8_t colorspace, int convert) {
+    for (size_t i = 0; i < count; ++i) {
+        uint8_t *c = &out[i].r;
+        out[i] = pixels[i];
+        for (int j = 0; j < 3; ++j) {
+            if ((convert & QOI_CONVERT_LINEAR) && colorspace != 1) c[j] = (uint8_t)(ref_srgb_to_linear(c[j]) + 0.5);
+            if (convert & QOI_CONVERT_PREMULTIPLY) c[j] = (uint8_t)((2 * c[j] * out[i].a + 255) / 510);
+        }
+    }
+}
+
+// Both sRGB tables of the library, against the transfer function: the 8-bit one rounded, the float
+// one up to the six decimals it is written with.
+bool check_srgb_tables(void) {
+    for (int c = 0; c < 256; ++c) {
+        double linear = ref_srgb_to_linear(c);
+        double difference = linear > qoi__srgb_to_linear_f32[c] ? linear - qoi__srgb_to_linear_f32[c] : qoi__srgb_to_linear_f32[c] - linear;
+        if (qoi__srgb_to_linear[c] != (uint8_t)(linear + 0.5) || difference > 1e-5) {
+            fprintf(stderr, "ERROR: the sRGB to linear tables are off at %d\n", c);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// qoi_decode_into, or qoi_decode_into_converted for any other `convert`, with `padding` bytes after
+// every row, which have to stay untouched.
+bool agrees_into(const uint8_t *data, size_t size, const Reference *ref, qoi_layout layout, size_t padding, int convert) {
+    // a header can claim billions of empty rows, so those get no buffer and no padding
+    uint32_t width = ref->header.width, height = ref->fits && width > 0 ? ref->header.height : 0;
+    if (width == 0) padding = 0;
+    size_t row_size = (size_t)width * (layout == QOI_LAYOUT_RGB ? 3 : 4), stride = padding > 0 ? row_size + padding : 0;
+    size_t pixels_size = (row_size + padding) * height;
+    uint8_t *pixels = QOI_Malloc(pixels_size + 1);
+    uint8_t *expected = QOI_Malloc(pixels_size + 1);
+    qoi_rgba *converted = QOI_Malloc((size_t)width * height * sizeof(qoi_rgba) + 1);
+    assert(pixels != NULL && expected != NULL && converted != NULL && "Get MORE RAM!");
+    memset(pixels, 0xA5, pixels_size);
+    memset(expected, 0xA5, pixels_size);
+
+    qoi_header header;
+    bool accepted = convert == QOI_CONVERT_NONE ? qoi_decode_into(data, size, &header, pixels, pixels_size, stride, layout)
+                                                : qoi_decode_into_converted(data, size, &header, pixels, pixels_size, stride, layout, convert);
+    bool result = accepted == ref->valid;
+    if (result && accepted) {
+        ref_convert(converted, ref->pixels, (size_t)width * height, ref->header.colorspace, convert);
+        ref_store(expected, converted, width, height, stride, layout);
+        result = memcmp(pixels, expected, pixels_size) == 0;
+    }
+
+    QOI_Free(converted);
+    QOI_Free(expected);
+    QOI_Free(pixels);
+    return result;
+}
+
+// qoi_decode_region_into in `layout` with `padding` bytes after every row, and qoi_decode_region, for
+// a random rectangle of up to 256x256 pixels inside the image, or one reaching a column past it, which
+// has to be rejected. A region only needs the ops up to its last pixel. The rows above it may be
+// skipped from a checkpoint, so with a seek index that isn't trusted only the bounds are checked.
+bool agrees_region(const uint8_t *data, size_t size, const Reference *ref, qoi_layout layout, size_t padding, bool trust_index) {
+    uint32_t image_width = ref->header.width, image_height = ref->header.height;
+    uint32_t x = (uint32_t)(rng() % ((uint64_t)image_width + 1));
+    uint32_t y = (uint32_t)(rng() % ((uint64_t)image_height + 1));
+    uint32_t width = rng() % ((image_width - x < 256 ? image_width - x : 256) + 1);
+    uint32_t height = rng() % ((image_height - y < 256 ? image_height - y : 256) + 1);
+    bool outside = rng() % 8 == 0 && image_width < UINT32_MAX;
+    if (outside) x = image_width - width + 1;
+
+    size_t last = width > 0 && height > 0 ? ((size_t)y + height - 1) * image_width + x + width : 0;
+    bool expected = ref->ended && !outside && ref->decoded >= last;
+    if (width == 0) padding = 0;
+    size_t row_size = (size_t)width * (layout == QOI_LAYOUT_RGB ? 3 : 4), stride = padding > 0 ? row_size + padding : 0;
+    size_t pixels_size = (row_size + padding) * height;
+    qoi_rgba *crop = QOI_Malloc((size_t)width * height * sizeof(qoi_rgba) + 1);
+    uint8_t *pixels = QOI_Malloc(pixels_size + 1);
+    uint8_t *stored = QOI_Malloc(pixels_size + 1);
+    assert(crop != NULL && pixels != NULL && stored != NULL && "Get MORE RAM!");
+    memset(pixels, 0xA5, pixels_size);
+    memset(stored, 0xA5, pixels_size);
+
+    qoi_header header;
+    qoi_image region = {0};
+    bool accepted = qoi_decode_region_into(data, size, &header, x, y, width, height, pixels, pixels_size, stride, layout);
+    bool accepted_image = qoi_decode_region(data, size, x, y, width, height, &region);
+    bool result;
+    if (ref->indexed && !trust_index) {
+        result = !outside || (!accepted && !accepted_image);
+    }
+    else {
+        result = accepted == expected && accepted_image == expected;
+        if (result && expected) {
+            for (uint32_t j = 0; j < height; ++j) {
+                memcpy(crop + (size_t)j * width, ref->pixels + ((size_t)y + j) * image_width + x, width * sizeof(qoi_rgba));
+            }
+            ref_store(stored, crop, width, height, stride, layout);
+            result = memcmp(pixels, stored, pixels_size) == 0 &&
+                     region.header.width == width && region.header.height == height && region.image_data.count == (size_t)width * height &&
+                     memcmp(region.image_data.items, crop, (size_t)width * height * sizeof(qoi_rgba)) == 0;
+        }
+    }
+
+    qoi_free_image(&region);
+    QOI_Free(stored);
+    QOI_Free(pixels);
+    QOI_Free(crop);
+    return result;
+}
+
+// qoi_decode_downscaled with a random factor, now and then one it has to reject, against a box filter
+// over the reference pixels: rounded means of factor x factor boxes, cut at the right and bottom edges.
+bool agrees_downscaled(const uint8_t *data, size_t size, const Reference *ref) {
+    uint32_t factor = rng() % 16 == 0 ? rng() % 2 * (QOI_DOWNSCALE_MAX + 1) : rng() % 4 == 0 ? 1 + rng() % QOI_DOWNSCALE_MAX : 1 + rng() % 8;
+    bool expected = ref->valid && factor > 0 && factor <= QOI_DOWNSCALE_MAX;
+    qoi_image thumb = {0};
+    bool accepted = qoi_decode_downscaled(data, size, factor, &thumb);
+    bool result = accepted == expected;
+
+    if (result && accepted) {
+        uint32_t width = ref->header.width, height = ref->header.height;
+        uint32_t out_width = (uint32_t)(((uint64_t)width + factor - 1) / factor), out_height = (uint32_t)(((uint64_t)height + factor - 1) / factor);
+        result = thumb.header.width == out_width && thumb.header.height == out_height && thumb.image_data.count == (size_t)out_width * out_height;
+        for (uint32_t ty = 0; result && ty < out_height; ++ty) {
+            for (uint32_t tx = 0; result && tx < out_width; ++tx) {
+                uint64_t sum[4] = {0}, n = 0;
+                for (uint32_t y = ty * factor; y < height && y < (ty + 1) * factor; ++y) {
+                    for (uint32_t x = tx * factor; x < width && x < (tx + 1) * factor; ++x, ++n) {
+                        qoi_rgba px = ref->pixels[(size_t)y * width + x];
+                        sum[0] += px.r;
+                        sum[1] += px.g;
+                        sum[2] += px.b;
+                        sum[3] += px.a;
+                    }
+                }
+                qoi_rgba px = thumb.image_data.items[(size_t)ty * out_width + tx];
+                result = px.r == (sum[0] + n / 2) / n && px.g == (sum[1] + n / 2) / n && px.b == (sum[2] + n / 2) / n && px.a == (sum[3] + n / 2) / n;
+            }
+        }
+    }
+
+    qoi_free_image(&thumb);
+    return result;
+}
+
+// Float samples computed as `product + bias` may be off by a rounding of the product in builds that
+// fuse the multiply and add, which is a lot more than a rounding of the sum when the two cancel out.
+bool close_to(float value, float product, float bias) {
+    float expected = product + bias;
+    float difference = value > expected ? value - expected : expected - value;
+    return difference <= 1e-6f * (1.0f + (product < 0 ? -product : product) + (bias < 0 ? -bias : bias));
+}
+
+// qoi_decode_planar, qoi_decode_planar_f32 and qoi_decode_planar_f32_converted, with a random scale
+// and bias or none, a plane left out now and then, and now and then planes one sample too small, which
+// have to be rejected. Converted color samples are linearized through the float table of the library,
+// which check_srgb_tables compares with the transfer function.
+bool agrees_planar(const uint8_t *data, size_t size, const Reference *ref) {
+    size_t count = ref->fits ? ref->pixel_count : 0;
+    bool too_small = count > 0 && rng() % 8 == 0;
+    size_t plane_size = count - too_small;
+    uint8_t *bytes = QOI_Malloc(count * 4 + 1);
+    float *floats = QOI_Malloc(count * 4 * sizeof(float) + 1);
+    float *converted = QOI_Malloc(count * 4 * sizeof(float) + 1);
+    assert(bytes != NULL && floats != NULL && converted != NULL && "Get MORE RAM!");
+
+    uint32_t skipped = rng() % 5; // 4 skips none
+    uint8_t *planes[4];
+    float *float_planes[4], *converted_planes[4], scale[4], bias[4];
+    for (uint32_t c = 0; c < 4; ++c) {
+        planes[c] = c == skipped ? NULL : bytes + c * count;
+        float_planes[c] = c == skipped ? NULL : floats + c * count;
+        converted_planes[c] = c == skipped ? NULL : converted + c * count;
+        scale[c] = ((int)(rng() % 2001) - 1000) / 100.0f;
+        bias[c] = ((int)(rng() % 2001) - 1000) / 10.0f;
+    }
+    bool scaled = rng() % 4 != 0;
+    int convert = rng() % 4;
+    bool linear = (convert & QOI_CONVERT_LINEAR) && ref->header.colorspace != 1, premultiply = convert & QOI_CONVERT_PREMULTIPLY;
+
+    qoi_header header;
+    bool expected = ref->valid && !too_small;
+    bool accepted = qoi_decode_planar(data, size, &header, planes, plane_size);
+    bool accepted_f32 = qoi_decode_planar_f32(data, size, &header, float_planes, plane_size, scaled ? scale : NULL, scaled ? bias : NULL);
+    bool accepted_converted = qoi_decode_planar_f32_converted(data, size, &header, converted_planes, plane_size, scaled ? scale : NULL, scaled ? bias : NULL, convert);
+    bool result = accepted == expected && accepted_f32 == expected && accepted_converted == expected;
+    for (size_t i = 0; result && expected && i < count; ++i) {
+        const uint8_t channels[4] = { ref->pixels[i].r, ref->pixels[i].g, ref->pixels[i].b, ref->pixels[i].a };
+        for (uint32_t c = 0; result && c < 4; ++c) {
+            if (c == skipped) continue;
+            float product = scaled ? channels[c] * scale[c] : channels[c];
+            float value = c < 3 && linear ? qoi__srgb_to_linear_f32[channels[c]] : channels[c];
+            if (c < 3 && premultiply) value *= channels[3] * (1.0f / 255.0f);
+            float converted_product = scaled ? value * scale[c] : value;
+            result = bytes[c * count + i] == channels[c] && close_to(floats[c * count + i], product, scaled ? bias[c] : 0.0f) &&
+                     close_to(converted[c * count + i], converted_product, scaled ? bias[c] : 0.0f);
+        }
+    }
+
+    QOI_Free(converted);
+    QOI_Free(floats);
+    QOI_Free(bytes);
+    return result;
+}
+
+typedef struct {
+    const Reference *ref;
+    uint32_t         rows;
+    bool             same; // every row came in order and, for a valid file, held the reference pixels
+} Rows;
+
+bool check_row(void *user, uint32_t y, const qoi_rgba *row, uint32_t width) {
+    Rows *rows = user;
+    const Reference *ref = rows->ref;
+    if (y != rows->rows++ || y >= ref->header.height || width != ref->header.width) rows->same = false;
+    else if (ref->valid && memcmp(row, ref->pixels + (size_t)y * width, width * sizeof(qoi_rgba)) != 0) rows->same = false;
+    return true;
+}
+
+// The push decoder fed `chunk` bytes at a time, or random amounts for 0, sometimes limited to one
+// pixel less than the image has. It stops at the end marker, so it may accept files the reference
+// doesn't (whatever follows the marker), but it has to accept every exact one and hand over the
+// reference rows whenever both accept. Empty images have no rows to hand over.
+bool agrees_push(const uint8_t *data, size_t size, const Reference *ref, size_t chunk) {
+    Rows rows = { ref, 0, true };
+    qoi_decoder decoder;
+    qoi_decoder_init(&decoder, check_row, &rows);
+    bool below = false;
+    if (ref->pixel_count <= QOI_PIXELS_MAX) {
+        below = ref->pixel_count > 0 && rng() % 4 == 0;
+        decoder.max_pixels = (uint32_t)ref->pixel_count - below;
+    }
+
+    bool accepted = true;
+    for (size_t at = 0; accepted && at < size;) {
+        size_t count = chunk > 0 ? chunk : 1 + rng() % 64;
+        if (count > size - at) count = size - at;
+        accepted = qoi_decoder_push(&decoder, data + at, count);
+        at += count;
+    }
+    accepted = accepted && qoi_decoder_finish(&decoder);
+    qoi_decoder_free(&decoder);
+
+    if (below) return !accepted;
+    if (!accepted) return !ref->exact;
+    return rows.same && (!ref->valid || rows.rows == (ref->header.width > 0 ? ref->header.height : 0));
+}
+
+// One context for the whole run, so every qoi_ctx_* call reuses the buffers the ones before it left,
+// whether they failed or not.
+static qoi_ctx reused_ctx;
+
+// Runs every decoder over the file and returns the name of the first one that disagrees with the
+// reference decoder, by accepting a file it can't decode, rejecting one it can, or decoding other
+// pixels. NULL when they all agree. Parallel and region decoding trust the checkpoints of a seek
+// index, so with one they only have to agree when `trust_index` tells the index is right. The
+// validators have to accept exactly the files whose ops hold the image and nothing more.
+const char *check_decoders(const uint8_t *data, size_t size, uint32_t threads, bool trust_index) {
+    Reference ref = ref_decode_file(data, size);
+    const char *failed = NULL;
+    quiet_stderr(true);
+
+    qoi_image image = {0};
+    if (!agrees_image(qoi_decode(data, size, &image), &image, &ref)) failed = "qoi_decode";
+    else if (!agrees_image(qoi_decode_parallel(data, size, &image, threads), &image, &ref) && (trust_index || !ref.indexed)) failed = "qoi_decode_parallel";
+    else if (!agrees_image(qoi_decode_limited(data, size, &image, (uint32_t)ref.pixel_count, 1), &image, &ref)) failed = "qoi_decode_limited";
+    else if (ref.valid && ref.pixel_count > 0 && qoi_decode_limited(data, size, &image, (uint32_t)ref.pixel_count - 1, 1)) failed = "qoi_decode_limited below the pixel count";
+    else if (!agrees_image(qoi_ctx_decode(&reused_ctx, data, size), &reused_ctx.image, &ref)) failed = "qoi_ctx_decode";
+    qoi_free_image(&image);
+
+    for (size_t l = 0; failed == NULL && l < sizeof(layouts) / sizeof(layouts[0]); ++l) {
+        if (!agrees_into(data, size, &ref, layouts[l], rng() % 2 ? 0 : rng() % 9, QOI_CONVERT_NONE)) failed = "qoi_decode_into";
+        else if (!agrees_into(data, size, &ref, layouts[l], rng() % 2 ? 0 : rng() % 9, 1 + rng() % 3)) failed = "qoi_decode_into_converted";
+        else if (!agrees_region(data, size, &ref, layouts[l], rng() % 2 ? 0 : rng() % 9, trust_index)) failed = "qoi_decode_region";
+    }
+    if (failed == NULL && !agrees_downscaled(data, size, &ref)) failed = "qoi_decode_downscaled";
+    if (failed == NULL && !agrees_planar(data, size, &ref)) failed = "qoi_decode_planar";
+    if (failed == NULL && !agrees_push(data, size, &ref, 1)) failed = "qoi_decoder_push byte by byte";
+    if (failed == NULL && !agrees_push(data, size, &ref, 0)) failed = "qoi_decoder_push";
+    qoi_header header;
+    uint64_t hash = 0;
+    if (failed == NULL && qoi_validate(data, size, &header) != ref.exact) failed = "qoi_validate";
+    if (failed == NULL && (qoi_validate_hash(data, size, &header, &hash) != ref.exact || (ref.exact && hash != ref_pixels_hash(&ref)))) failed = "qoi_validate_hash";
+
+    quiet_stderr(false);
+    QOI_Free(ref.pixels);
+    return failed;
+}
+
+// Random images mixing what each op is for: RUNs, recent colors (INDEX), small steps (DIFF, LUMA),
+// big jumps (RGB) and alpha changes (RGBA), with the step size picked per image.
+qoi_rgba *random_image(uint32_t width, uint32_t height) {
+    static const uint32_t steps[] = { 2, 4, 40, 256 };
+    size_t count = (size_t)width * height;
+    qoi_rgba *pixels = QOI_Malloc(count * sizeof(qoi_rgba) + 1);
+    assert(pixels != NULL && "Get MORE RAM!");
+
+    uint32_t step = steps[rng() % 4];
+    bool opaque = rng() % 3 == 0;
+    qoi_rgba px = { 0, 0, 0, 255 };
+    for (size_t i = 0, run = 0; i < count; ++i) {
+        uint32_t pattern = rng() % 16;
+        if (run > 0) {
+            --run;
+        }
+        else if (pattern == 0) {
+            run = rng() % 200;
+        }
+        else if (pattern < 4) {
+            // the previous pixel again
+        }
+        else if (pattern < 7 && i >= 16) {
+            px = pixels[i - 1 - rng() % 16];
+        }
+        else {
+            px.r += rng() % step - step / 2;
+            px.g += rng() % step - step / 2;
+            px.b += rng() % step - step / 2;
+            if (!opaque && rng() % 8 == 0) px.a = rng();
+        }
+        pixels[i] = px;
+    }
+
+    return pixels;
+}
+
+// Encodes the pixels stored in every layout, known-opaque or not, with qoi_encode_layout; the bytes
+// have to match the reference encoder on the pixels that layout keeps.
+bool check_layouts(const char *name, uint32_t width, uint32_t height, const qoi_rgba *pixels) {
+    size_t count = (size_t)width * height;
+    size_t capacity = qoi_max_encoded_size(width, height, 4);
+    uint8_t *stored = QOI_Malloc(count * 4 + 1);
+    qoi_rgba *kept = QOI_Malloc(count * sizeof(qoi_rgba) + 1);
+    uint8_t *expected = QOI_Malloc(capacity);
+    uint8_t *encoded = QOI_Malloc(capacity);
+    assert(stored != NULL && kept != NULL && expected != NULL && encoded != NULL && "Get MORE RAM!");
+
+    bool result = true;
+    for (size_t l = 0; result && l < sizeof(layouts) / sizeof(layouts[0]); ++l) {
+        ref_store(stored, pixels, width, height, 0, layouts[l]);
+        for (int opaque = 0; result && opaque < 2; ++opaque) {
+            bool no_alpha = opaque || layouts[l] == QOI_LAYOUT_RGB;
+            for (size_t i = 0; i < count; ++i) kept[i] = (qoi_rgba){ pixels[i].r, pixels[i].g, pixels[i].b, no_alpha ? 255 : pixels[i].a };
+
+            size_t expected_size = ref_encode(expected, width, height, no_alpha ? 3 : 4, 0, kept);
+            size_t size = qoi_encode_layout(encoded, capacity, width, height, 0, stored, layouts[l], opaque);
+            if (size != expected_size || memcmp(encoded, expected, size) != 0) {
+                fprintf(stderr, "ERROR: %s: qoi_encode_layout output for %s%s differs from the reference encoder\n", name, layout_names[l], opaque ? " (opaque)" : "");
+                result = false;
+            }
+        }
+    }
+
+    QOI_Free(encoded);
+    QOI_Free(expected);
+    QOI_Free(kept);
+    QOI_Free(stored);
+    return result;
+}
+
+// Encodes the pixels with a seek index every few rows, or with the default spacing: the file has to
+// be the qoi_encode one followed by the index, and qoi_decode_parallel has to resume from its
+// checkpoints to the same pixels with every thread count.
+bool check_indexed(const char *name, uint32_t width, uint32_t height, uint8_t channels, uint8_t colorspace, const qoi_rgba *pixels, const uint8_t *encoded, size_t encoded_size, uint32_t threads) {
+    uint32_t rows = rng() % 4 == 0 ? 0 : 1 + rng() % (height + 1);
+    qoi_bytes bytes = {0};
+    bool result = qoi_encode_to_bytes_indexed(&bytes, width, height, channels, colorspace, pixels, rows);
+    if (rows == 0) rows = width > 0 && width < QOI_INDEX_BAND_PIXELS ? QOI_INDEX_BAND_PIXELS / width : 1;
+    uint32_t checkpoint_count = height > 0 ? (height - 1) / rows : 0;
+    size_t index_size = (size_t)checkpoint_count * QOI_CHECKPOINT_SIZE + QOI_INDEX_FOOTER_SIZE;
+    const uint8_t *footer = bytes.items + bytes.count - QOI_INDEX_FOOTER_SIZE;
+    if (!result || bytes.count != encoded_size + index_size || memcmp(bytes.items, encoded, encoded_size) != 0 ||
+        ref_read_u32be(footer) != checkpoint_count || ref_read_u32be(footer + 4) != rows || memcmp(footer + 8, QOI_INDEX_MAGIC, 4) != 0) {
+        fprintf(stderr, "ERROR: %s: qoi_encode_to_bytes_indexed output isn't the qoi_encode one followed by a seek index\n", name);
+        result = false;
+    }
+
+    size_t count = (size_t)width * height;
+    qoi_image image = {0};
+    for (uint32_t t = 1; result && t <= threads; ++t) {
+        bool accepted = qoi_decode_parallel(bytes.items, bytes.count, &image, t);
+        if (!accepted || image.image_data.count != count || (count > 0 && memcmp(image.image_data.items, pixels, count * sizeof(qoi_rgba)) != 0)) {
+            fprintf(stderr, "ERROR: %s: qoi_decode_parallel with %u threads doesn't get the pixels back from a seek index every %u rows\n", name, t, rows);
+            result = false;
+        }
+    }
+    qoi_free_image(&image);
+
+    const char *failed = result ? check_decoders(bytes.items, bytes.count, threads, true) : NULL;
+    if (result && failed == NULL) {
+        // an empty index after the index: only the last one is split off, so no decoder may accept it
+        qoi_da_reserve(&bytes, bytes.count + QOI_INDEX_FOOTER_SIZE);
+        ref_write_u32be(bytes.items + bytes.count, 0);
+        ref_write_u32be(bytes.items + bytes.count + 4, rows);
+        memcpy(bytes.items + bytes.count + 8, QOI_INDEX_MAGIC, 4);
+        failed = check_decoders(bytes.items, bytes.count + QOI_INDEX_FOOTER_SIZE, threads, true);
+    }
+    if (failed != NULL) {
+        fprintf(stderr, "ERROR: %s: %s disagrees with the reference decoder on the indexed file\n", name, failed);
+        result = false;
+    }
+
+    qoi_free_bytes(&bytes);
+    return result;
+}
+
+// Pushes the pixels into qoi_encoder_* in batches of random row counts; the bytes handed to the
+// writer have to be the qoi_encode ones, and finishing early or pushing past the last row has to fail.
+bool check_encoder(const char *name, uint32_t width, uint32_t height, uint8_t channels, uint8_t colorspace, const qoi_rgba *pixels, const uint8_t *encoded, size_t encoded_size) {
+    static qoi_encoder encoder; // too big for the stack of some platforms
+    qoi_bytes bytes = {0};
+    bool result = qoi_encoder_begin(&encoder, width, height, channels, colorspace, qoi_bytes_writer, &bytes);
+    quiet_stderr(true);
+    for (uint32_t row = 0; result && row < height;) {
+        uint32_t rows = 1 + rng() % (rng() % 4 == 0 ? height - row : 4);
+        if (rows > height - row) rows = height - row;
+        if (rng() % 8 == 0 && qoi_encoder_finish(&encoder)) result = false;
+        result = result && qoi_encoder_push_rows(&encoder, pixels + (size_t)row * width, rows);
+        row += rows;
+    }
+    if (result && qoi_encoder_push_rows(&encoder, pixels, 1)) result = false;
+    quiet_stderr(false);
+    result = result && qoi_encoder_finish(&encoder);
+
+    if (!result || bytes.count != encoded_size || memcmp(bytes.items, encoded, encoded_size) != 0) {
+        fprintf(stderr, "ERROR: %s: qoi_encoder_* output differs from qoi_encode\n", name);
+        result = false;
+    }
+
+    qoi_free_bytes(&bytes);
+    return result;
+}
+
+// Encodes random images with qoi_encode, compares the bytes with the reference encoder and decodes
+// them back with every decoder.
+bool check_corpus(size_t count, uint32_t threads) {
+    bool result = true;
+    for (size_t t = 0; result && t < count; ++t) {
+        bool large = t % 50 == 49; // past QOI_PARALLEL_MIN_PIXELS
+        uint32_t width = large ? 256 + rng() % 512 : rng() % 98;
+        uint32_t height = large ? 256 + rng() % 256 : rng() % 51;
+        uint8_t channels = rng() % 2 ? 4 : 3, colorspace = rng() % 2;
+        qoi_rgba *pixels = random_image(width, height);
+
+        size_t capacity = qoi_max_encoded_size(width, height, 4);
+        uint8_t *expected = QOI_Malloc(capacity);
+        uint8_t *encoded = QOI_Malloc(capacity);
+        assert(expected != NULL && encoded != NULL && "Get MORE RAM!");
+
+        char name[64];
+        snprintf(name, sizeof(name), "image %zu (%ux%u)", t, width, height);
+        size_t expected_size = ref_encode(expected, width, height, channels, colorspace, pixels);
+        size_t size = qoi_encode(encoded, capacity, width, height, channels, colorspace, pixels);
+        if (size != expected_size || memcmp(encoded, expected, size) != 0) {
+            fprintf(stderr, "ERROR: %s: qoi_encode output differs from the reference encoder\n", name);
+            result = false;
+        }
+        if (t % 100 == 99) qoi_ctx_free(&reused_ctx); // starting over has to work too
+        bool ctx_encoded = qoi_ctx_encode(&reused_ctx, width, height, channels, colorspace, pixels);
+        if (result && (!ctx_encoded || reused_ctx.encoded.count != size || memcmp(reused_ctx.encoded.items, encoded, size) != 0)) {
+            fprintf(stderr, "ERROR: %s: qoi_ctx_encode output differs from qoi_encode\n", name);
+            result = false;
+        }
+
+        Reference ref = ref_decode_file(encoded, size);
+        if (result && (!ref.valid || !ref.exact || (ref.pixel_count > 0 && memcmp(ref.pixels, pixels, ref.pixel_count * sizeof(qoi_rgba)) != 0))) {
+            fprintf(stderr, "ERROR: %s: the reference decoder doesn't get the pixels back\n", name);
+            result = false;
+        }
+        QOI_Free(ref.pixels);
+
+        const char *failed = result ? check_decoders(encoded, size, threads, false) : NULL;
+        if (failed != NULL) {
+            fprintf(stderr, "ERROR: %s: %s disagrees with the reference decoder\n", name, failed);
+            result = false;
+        }
+        if (result) result = check_parallel(name, width, height, pixels, threads);
+        if (result) result = check_layouts(name, width, height, pixels);
+        if (result) result = check_indexed(name, width, height, channels, colorspace, pixels, encoded, size, threads);
+        if (result) result = check_encoder(name, width, height, channels, colorspace, pixels, encoded, size);
+
+        QOI_Free(encoded);
+        QOI_Free(expected);
+        QOI_Free(pixels);
+    }
+
+    return result;
+}
+
+// Random op streams, and encoded images, some with a seek index, cut short, with bytes flipped, with
+// another size in the header or with ops inserted, through every decoder: run under a sanitizer, no
+// input may fault.
+bool check_fuzz(size_t count, uint32_t threads) {
+    bool result = true;
+    for (size_t t = 0; result && t < count; ++t) {
+        uint32_t width = rng() % 41, height = rng() % 21;
+        size_t capacity = qoi_max_encoded_size(width, height, 4) + (size_t)height * QOI_CHECKPOINT_SIZE + 1024;
+        uint8_t *data = QOI_Malloc(capacity);
+        assert(data != NULL && "Get MORE RAM!");
+
+        size_t size;
+        if (t % 2 == 0) {
+            size = QOI_HEADER_SIZE + rng() % 600;
+            ref_write_header(data, width, height, 4, 0);
+            for (size_t i = QOI_HEADER_SIZE; i < size; ++i) {
+                uint32_t kind = rng() % 16;
+                data[i] = kind < 4 ? RUN | rng() % 62 : kind == 4 ? (rng() % 2 ? RGB : RGBA) : rng();
+            }
+            memcpy(data + size, QOI_END, QOI_END_SIZE);
+            size += QOI_END_SIZE;
+        }
+        else {
+            qoi_rgba *pixels = random_image(width, height);
+            if (rng() % 4 == 0) {
+                qoi_bytes bytes = {0};
+                qoi_encode_to_bytes_indexed(&bytes, width, height, 4, 0, pixels, 1 + rng() % 8);
+                memcpy(data, bytes.items, bytes.count);
+                size = bytes.count;
+                qoi_free_bytes(&bytes);
+            }
+            else {
+                size = ref_encode(data, width, height, 4, 0, pixels);
+            }
+            QOI_Free(pixels);
+
+            switch (rng() % 4) {
+            case 0: // cut short
+                size = rng() % size;
+                break;
+            case 1: // bytes flipped anywhere, header and end marker included
+                for (uint32_t flips = 1 + rng() % 4; flips > 0; --flips) data[rng() % size] ^= 1 << rng() % 8;
+                break;
+            case 2: // another size in the header, sometimes a huge one
+                ref_write_u32be(data + 4 + rng() % 2 * 4, rng() % 4 == 0 ? rng() : rng() % 64);
+                break;
+            case 3: { // random ops inserted
+                size_t at = QOI_HEADER_SIZE + rng() % (size - QOI_HEADER_SIZE - QOI_END_SIZE + 1);
+                size_t inserted = 1 + rng() % 16;
+                memmove(data + at + inserted, data + at, size - at);
+                for (size_t i = 0; i < inserted; ++i) data[at + i] = rng();
+                size += inserted;
+            } break;
+            }
+        }
+
+        const char *failed = check_decoders(data, size, threads, false);
+        if (failed != NULL) {
+            fprintf(stderr, "ERROR: fuzz input %zu (%zu bytes): %s disagrees with the reference decoder\n", t, size, failed);
+            result = false;
+        }
+        QOI_Free(data);
+    }
+
+    return result;
+}
+
+int main(int argc, char **argv) {
+    bool *help = flag_bool("help", false, "Print this help to stdout and exit with 0");
+    size_t *threads = flag_size("j", 8, "Highest thread count the parallel encoder is checked with");
+    uint64_t *seed = flag_uint64("seed", 1, "Seed of the random images and fuzz inputs");
+    size_t *images = flag_size("images", 300, "Random images checked against the reference encoder and decoder");
+    size_t *fuzz = flag_size("fuzz", 3000, "Random and corrupted files every decoder is checked with");
+
+    if (!flag_parse(argc, argv)) {
+        usage(stderr);
+        flag_print_error(stderr);
+        return 1;
+    }
+
+    if (*help) {
+        usage(stdout);
+        exit(0);
+    }
+    if (*threads == 0) *threads = 1;
+    rng_state = *seed != 0 ? *seed : 1;
+
+    bool result = check_run_62() && check_run_62_stripes((uint32_t)*threads) && check_srgb_tables();
+    result = result && check_corpus(*images, (uint32_t)*threads);
+    result = result && check_fuzz(*fuzz, (uint32_t)*threads);
+    qoi_ctx ctx = {0};
+    for (int i = 0; result && i < flag_rest_argc(); ++i) {
+        const char *path = flag_rest_argv()[i];
+        if (!qoi_ctx_load_image(&ctx, path)) return 2;
+        result = check_parallel(path, ctx.image.header.width, ctx.image.header.height, ctx.image.image_data.items, (uint32_t)*threads);
+
+        const char *failed = result ? check_decoders(ctx.input.items, ctx.input.count, (uint32_t)*threads, false) : NULL;
+        if (failed != NULL) {
+            fprintf(stderr, "ERROR: %s: %s disagrees with the reference decoder\n", path, failed);
+            result = false;
+        }
+    }
+    qoi_ctx_free(&ctx);
+    qoi_ctx_free(&reused_ctx);
+
+    if (!result) return 3;
+    printf("OK (%s)\n", qoi_simd_name(qoi_simd()));
+    return 0;
+}
@@ -0,0 +1,134 @@
+#define QOI_IMPLEMENTATION
+#include "../qoi.h"
+#define FLAG_IMPLEMENTATION
+#include "../thirdparty/flag.h"
+
+#include "batch.h"
+
+typedef struct {
+    qoi_header header;
+    uint64_t   size;
+    bool       ok;
+} Entry;
+
+typedef struct {
+    const Paths *paths;
+    Entry       *entries;
+} Worker;
+
+void usage(FILE *stream)
+{
+    fprintf(stream, "Usage: ./qoi_scan [OPTIONS] <files, directories or globs...>\n");
+    fprintf(stream, "OPTIONS:\n");
+    flag_print_options(stream);
+}
+
+void scan_job(void *arg, size_t job) {
+    Worker *worker = arg;
+    Entry *entry = &worker->entries[job];
+    entry->ok = qoi_probe_file(worker->paths->items[job], &entry->header, &entry->size);
+}
+
+void print_csv_path(FILE *stream, const char *path) {
+    if (strpbrk(path, ",\"\n") == NULL) {
+        fputs(path, stream);
+        return;
+    }
+
+    fputc('"', stream);
+    for (; *path != '\0'; ++path) {
+        if (*path == '"') fputc('"', stream);
+        fputc(*path, stream);
+    }
+    fputc('"', stream);
+}
+
+void print_json_path(FILE *stream, const char *path) {
+    fputc('"', stream);
+    for (; *path != '\0'; ++path) {
+        if (*path == '"' || *path == '\\') fprintf(stream, "\\%c", *path);
+        else if ((unsigned char)*path < 0x20) fprintf(stream, "\\u%04x", *path);
+        else fputc(*path, stream);
+    }
+    fputc('"', stream);
+}
+
+int main(int argc, char **argv) {
+    bool *help = flag_bool("help", false, "Print this help to stdout and exit with 0");
+    char **format = flag_str("format", "csv", "Manifest format: csv or json");
+    size_t *threads = flag_size("j", 0, "Threads used to read the headers (0 uses every core)");
+
+    if (!flag_parse(argc, argv)) {
+        usage(stderr);
+        flag_print_error(stderr);
+        return 1;
+    }
+
+    if (*help) {
+        usage(stdout);
+        exit(0);
+    }
+
+    bool json = strcmp(*format, "json") == 0;
+    if (!json && strcmp(*format, "csv") != 0) {
+        usage(stderr);
+        fprintf(stderr, "ERROR: Unknown -%s %s\n", flag_name(format), *format);
+        return 1;
+    }
+    if (flag_rest_argc() == 0) {
+        usage(stderr);
+        fprintf(stderr, "ERROR: No files or directories were provided\n");
+        return 1;
+    }
+
+    int result = 0;
+    Paths paths = {0};
+    for (int i = 0; i < flag_rest_argc(); ++i) {
+        if (!collect_input(flag_rest_argv()[i], ".qoi", &paths)) result = 2;
+    }
+
+    Entry *entries = calloc(paths.count + 1, sizeof(Entry));
+    assert(entries != NULL && "Get MORE RAM!");
+
+    size_t thread_count = *threads == 0 ? qoi_cpu_count() : *threads;
+    if (thread_count > paths.count) thread_count = paths.count > 0 ? paths.count : 1;
+    Worker *workers = malloc(thread_count * sizeof(Worker));
+    assert(workers != NULL && "Get MORE RAM!");
+    for (size_t t = 0; t < thread_count; ++t) {
+        workers[t] = (Worker){ .paths = &paths, .entries = entries };
+    }
+
+    // reading a header costs about the same for every file, so the jobs have no costs
+    run_jobs(paths.count, NULL, thread_count, scan_job, workers, sizeof(Worker));
+
+    if (json) printf("[\n");
+    else printf("path,width,height,channels,colorspace,size\n");
+
+    bool first = true;
+    for (size_t i = 0; i < paths.count; ++i) {
+        if (!entries[i].ok) {
+            fprintf(stderr, "ERROR: Could not probe %s\n", paths.items[i]);
+            result = 2;
+            continue;
+        }
+
+        const qoi_header *header = &entries[i].header;
+        if (json) {
+            printf("%s  {\"path\": ", first ? "" : ",\n");
+            print_json_path(stdout, paths.items[i]);
+            printf(", \"width\": %u, \"height\": %u, \"channels\": %u, \"colorspace\": %u, \"size\": %llu}",
+                   header->width, header->height, header->channels, header->colorspace, (unsigned long long)entries[i].size);
+        }
+        else {
+            print_csv_path(stdout, paths.items[i]);
+            printf(",%u,%u,%u,%u,%llu\n", header->width, header->height, header->channels, header->colorspace, (unsigned long long)entries[i].size);
+        }
+        first = false;
+    }
+    if (json) printf("%s]\n", first ? "" : "\n");
+
+    free_paths(&paths);
+    free(entries);
+    free(workers);
+    return result;
+}
@@ -5,17 +5,97 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "../thirdparty/stb_image_write.h"
 
+#include "batch.h"
+
+typedef struct {
+    qoi_ctx      ctx; // file and pixel buffers reused from image to image
+    const Paths *inputs;
+    char       **outputs;
+    int         *results;
+} Worker;
+
 void usage(FILE *stream)
 {
-    fprintf(stream, "Usage: ./qoi_to_png [OPTIONS]\n");
+    fprintf(stream, "Usage: ./qoi_to_png [OPTIONS] [<qoi files, directories or globs...>]\n");
     fprintf(stream, "OPTIONS:\n");
     flag_print_options(stream);
 }
 
+int convert(qoi_ctx *ctx, const char *input_file, const char *output_file) {
+    if (!qoi_ctx_load_image(ctx, input_file)) {
+        return 2;
+    }
+
+    const qoi_header *header = &ctx->image.header;
+    if (!stbi_write_png(output_file, header->width, header->height, 4, ctx->image.image_data.items, 0)) {
+        fprintf(stderr, "ERROR: Could not write %s\n", output_file);
+        return 3;
+    }
+
+    return 0;
+}
+
+void convert_job(void *arg, size_t job) {
+    Worker *worker = arg;
+    worker->results[job] = convert(&worker->ctx, worker->inputs->items[job], worker->outputs[job]);
+}
+
+// Converts every input on a work-stealing pool, biggest files first. Returns the exit code of
+// the first input that failed.
+int convert_batch(const char *list_file, const char *output_dir, size_t threads) {
+    int result = 0;
+    Paths inputs = {0};
+    if (list_file != NULL && !collect_list(list_file, ".qoi", &inputs)) result = 2;
+    for (int i = 0; i < flag_rest_argc(); ++i) {
+        if (!collect_input(flag_rest_argv()[i], ".qoi", &inputs)) result = 2;
+    }
+
+    char **outputs = malloc((inputs.count + 1) * sizeof(char *));
+    uint64_t *costs = malloc((inputs.count + 1) * sizeof(uint64_t));
+    int *results = calloc(inputs.count + 1, sizeof(int));
+    assert(outputs != NULL && costs != NULL && results != NULL && "Get MORE RAM!");
+    for (size_t i = 0; i < inputs.count; ++i) outputs[i] = output_path(output_dir, inputs.items[i], ".png");
+    if (!unique_outputs(&inputs, outputs)) {
+        result = 1;
+        goto defer;
+    }
+    for (size_t i = 0; i < inputs.count; ++i) costs[i] = file_size(inputs.items[i]);
+
+    size_t thread_count = threads == 0 ? qoi_cpu_count() : threads;
+    if (thread_count > inputs.count) thread_count = inputs.count > 0 ? inputs.count : 1;
+    Worker *workers = calloc(thread_count, sizeof(Worker));
+    assert(workers != NULL && "Get MORE RAM!");
+    for (size_t t = 0; t < thread_count; ++t) {
+        workers[t] = (Worker){ .inputs = &inputs, .outputs = outputs, .results = results };
+    }
+
+    run_jobs(inputs.count, costs, thread_count, convert_job, workers, sizeof(Worker));
+
+    size_t converted = 0;
+    for (size_t i = 0; i < inputs.count; ++i) {
+        if (results[i] == 0) converted += 1;
+        else if (result == 0) result = results[i];
+    }
+    printf("Converted %zu of %zu images\n", converted, inputs.count);
+
+    for (size_t t = 0; t < thread_count; ++t) qoi_ctx_free(&workers[t].ctx);
+    free(workers);
+defer:
+    for (size_t i = 0; i < inputs.count; ++i) free(outputs[i]);
+    free(results);
+    free(costs);
+    free(outputs);
+    free_paths(&inputs);
+    return result;
+}
+
 int main(int argc, char **argv) {
     bool *help = flag_bool("help", false, "Print this help to stdout and exit with 0");
-    char **input_file = flag_str("input-image", NULL, "Input qoi image path to convert to png (MANDATORY)");
-    char **output_file = flag_str("output-image", NULL, "Output png image path (MANDATORY)");
+    char **input_file = flag_str("input-image", NULL, "Input qoi image path to convert to png (single image mode)");
+    char **output_file = flag_str("output-image", NULL, "Output png image path (single image mode)");
+    char **list_file = flag_str("list", NULL, "File listing the images to convert, one per line (batch mode)");
+    char **output_dir = flag_str("output-dir", NULL, "Directory the batch outputs go to (next to the inputs by default)");
+    size_t *threads = flag_size("j", 0, "Images converted at once in batch mode (0 uses every core)");
 
     if (!flag_parse(argc, argv)) {
         usage(stderr);
@@ -28,6 +108,15 @@ int main(int argc, char **argv) {
         exit(0);
     }
 
+    if (*list_file != NULL || flag_rest_argc() > 0) {
+        if (*input_file != NULL || *output_file != NULL) {
+            usage(stderr);
+            fprintf(stderr, "ERROR: -%s and -%s convert a single image and can't be used with a batch\n", flag_name(input_file), flag_name(output_file));
+            return 1;
+        }
+        return convert_batch(*list_file, *output_dir, *threads);
+    }
+
     if (*input_file == NULL) {
         usage(stderr);
         fprintf(stderr, "ERROR: No -%s was provided\n", flag_name(input_file));
@@ -39,15 +128,8 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    qoi_image image = {0};
-    if (!qoi_load_image(*input_file, &image)) {
-        return 2;
-    }
-
-    if (!stbi_write_png(*output_file, image.header.width, image.header.height, 4, image.image_data.items, 0)) {
-        return 3;
-    }
-
-    qoi_free_image(&image);
-    return 0;
+    qoi_ctx ctx = {0};
+    int result = convert(&ctx, *input_file, *output_file);
+    qoi_ctx_free(&ctx);
+    return result;
 }